@@ -1,5 +1,9 @@
 #include "access_point.h"
 
+#if defined(TCP_SND_BUF) && HTML_RESULT_SIZE + HTTP_HEADERS_MAX_SIZE > TCP_SND_BUF
+#error "HTML_RESULT_SIZE does not fit TCP_SND_BUF with the response headers"
+#endif
+
 SETTINGS *p_settings;
 
 // Calibration state
@@ -7,7 +11,58 @@ static bool calibration_active = false;
 
 char html_page[HTML_RESULT_SIZE];
 
+// Key map as ADC input numbers separated by commas, "-" for a key without input
+static void format_key_map(const uint8_t *key_map, char *text, size_t text_size) {
+    size_t len = 0;
+    text[0] = '\0';
+    for (int i = 0; i < MIDI_NO_TONES && len < text_size; ++i) {
+        const char *sep = (i > 0) ? "," : "";
+        if (key_map[i] == SETTINGS_KEY_MAP_UNMAPPED) {
+            len += snprintf(text + len, text_size - len, "%s-", sep);
+        } else {
+            len += snprintf(text + len, text_size - len, "%s%d", sep, key_map[i]);
+        }
+    }
+}
+
+// User velocity curve points separated by commas
+static void format_velocity_points(const uint8_t *points, char *text, size_t text_size) {
+    size_t len = 0;
+    text[0] = '\0';
+    for (int i = 0; i < VELOCITY_CURVE_USER_POINTS && len < text_size; ++i) {
+        len += snprintf(text + len, text_size - len, "%s%d", (i > 0) ? "," : "", points[i]);
+    }
+}
+
+// Options of a select with the value = index into names, the current one selected
+static void format_select_options(const char *const *names, int count, uint8_t current, char *text, size_t text_size) {
+    size_t len = 0;
+    text[0] = '\0';
+    for (int i = 0; i < count && len < text_size; ++i) {
+        len += snprintf(text + len, text_size - len, "<option value=\"%d\"%s>%s</option>",
+                        i, (i == current) ? " selected" : "", names[i]);
+    }
+}
+
 void update_html_page() {
+    char key_map_text[KEY_MAP_TEXT_SIZE];
+    uint8_t default_key_map[MIDI_NO_TONES];
+    char velocity_points_text[VELOCITY_POINTS_TEXT_SIZE];
+    uint8_t default_velocity_points[VELOCITY_CURVE_USER_POINTS];
+    char velocity_curve_options[SELECT_OPTIONS_SIZE(VELOCITY_CURVE_COUNT)];
+    uint8_t velocity_curve = p_settings ? p_settings->velocity_curve : SETTINGS_VELOCITY_CURVE_DEF;
+    char filter_options[SELECT_OPTIONS_SIZE(KEY_FILTER_COUNT)];
+    uint8_t filter_mode = p_settings ? p_settings->filter_mode : SETTINGS_FILTER_MODE_DEF;
+
+    settings_key_map_default(default_key_map);
+    format_key_map(p_settings ? p_settings->key_map : default_key_map, key_map_text, sizeof(key_map_text));
+    velocity_curve_user_default(default_velocity_points);
+    format_velocity_points(p_settings ? p_settings->velocity_user_curve : default_velocity_points,
+                           velocity_points_text, sizeof(velocity_points_text));
+    format_select_options(velocity_curve_names, VELOCITY_CURVE_COUNT, velocity_curve,
+                          velocity_curve_options, sizeof(velocity_curve_options));
+    format_select_options(key_filter_names, KEY_FILTER_COUNT, filter_mode, filter_options, sizeof(filter_options));
+
     // Create a simple, clean HTML interface
     memset(html_page, '\0', HTML_RESULT_SIZE);
     
@@ -49,19 +104,62 @@ void update_html_page() {
         "                <div class=\"current\">Current: %d</div>\n"
         "            </div>\n"
         "            <div class=\"setting\">\n"
-        "                <label>Base MIDI Note (0-127):</label>\n"
-        "                <input type=\"number\" name=\"m_base\" min=\"0\" max=\"127\" value=\"%d\">\n"
+        "                <label>Base MIDI Note (0-%d):</label>\n"
+        "                <input type=\"number\" name=\"m_base\" min=\"0\" max=\"%d\" value=\"%d\">\n"
         "                <div class=\"current\">Current: %d</div>\n"
         "            </div>\n"
         "            <div class=\"setting\">\n"
         "                <label>Fast MIDI Mode:</label>\n"
         "                <select name=\"fast_midi\">\n"
         "                    <option value=\"0\"%s>Standard MIDI (31.25 kbps)</option>\n"
-        "                    <option value=\"1\"%s>High Speed (Non-standard)</option>\n"
+        "                    <option value=\"1\"%s>High Speed (1 Mbaud, non-standard)</option>\n"
         "                </select>\n"
         "                <div class=\"current\">Current: %s</div>\n"
         "            </div>\n"
         "            <div class=\"setting\">\n"
+        "                <label>Scan Rate (%d-%d Hz):</label>\n"
+        "                <input type=\"number\" name=\"scan_rate\" min=\"%d\" max=\"%d\" value=\"%d\">\n"
+        "                <div class=\"current\">Current: %d Hz (applied after restart)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>Max SPI Clock (%d-%d kHz):</label>\n"
+        "                <input type=\"number\" name=\"spi_clock\" min=\"%d\" max=\"%d\" value=\"%d\">\n"
+        "                <div class=\"current\">Current: %d kHz (self-test picks the fastest stable clock at boot)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>Key Map (ADC input of each key from the lowest key):</label>\n"
+        "                <input type=\"text\" name=\"key_map\" value=\"%s\">\n"
+        "                <div class=\"current\">Input = chip x %d + channel, - = key not connected (applied after restart)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>Fixed Output Latency (0-%d us, 0 = send at once):</label>\n"
+        "                <input type=\"number\" name=\"output_delay\" min=\"0\" max=\"%d\" value=\"%d\">\n"
+        "                <div class=\"current\">Current: %d us (applied after restart)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>Key Filter:</label>\n"
+        "                <select name=\"filter_mode\">%s</select>\n"
+        "                <div class=\"current\">Current: %s (applied after restart)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>Velocity Measurement:</label>\n"
+        "                <select name=\"velocity_mode\">\n"
+        "                    <option value=\"0\"%s>Area (key travel over the last 15 ms)</option>\n"
+        "                    <option value=\"1\"%s>Time of flight (travel time between two thresholds)</option>\n"
+        "                </select>\n"
+        "                <div class=\"current\">Current: %s (applied after restart)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>Velocity Curve:</label>\n"
+        "                <select name=\"velocity_curve\">%s</select>\n"
+        "                <div class=\"current\">Current: %s (applied after restart)</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
+        "                <label>User Velocity Curve (%d velocities 1-127 from the softest to the hardest touch):</label>\n"
+        "                <input type=\"text\" name=\"velocity_user_curve\" value=\"%s\">\n"
+        "                <div class=\"current\">Used by the User curve, points in between are interpolated</div>\n"
+        "            </div>\n"
+        "            <div class=\"setting\">\n"
         "               <label>Keys trigger point calibration:</label>\n"
         "               <button type=\"button\" class=\"calibration-btn\" onclick=\"startCalibration()\">Start Calibration</button>"
         "            </div>\n"
@@ -99,11 +197,32 @@ void update_html_page() {
         DEV_NAME, DEV_NAME, FW_VERSION,
         p_settings ? p_settings->m_ch + 1 : 1,
         p_settings ? p_settings->m_ch + 1 : 1,
+        SETTINGS_M_BASE_MAX, SETTINGS_M_BASE_MAX,
         p_settings ? p_settings->m_base : 36,
         p_settings ? p_settings->m_base : 36,
         (p_settings && p_settings->fast_midi == 0) ? " selected" : "",
         (p_settings && p_settings->fast_midi == 1) ? " selected" : "",
         (p_settings && p_settings->fast_midi == 1) ? "High Speed" : "Standard",
+        SETTINGS_SCAN_RATE_MIN, SETTINGS_SCAN_RATE_MAX,
+        SETTINGS_SCAN_RATE_MIN, SETTINGS_SCAN_RATE_MAX,
+        p_settings ? p_settings->scan_rate : SETTINGS_SCAN_RATE_DEF,
+        p_settings ? p_settings->scan_rate : SETTINGS_SCAN_RATE_DEF,
+        SETTINGS_SPI_CLOCK_MIN, SETTINGS_SPI_CLOCK_MAX,
+        SETTINGS_SPI_CLOCK_MIN, SETTINGS_SPI_CLOCK_MAX,
+        p_settings ? p_settings->spi_clock : SETTINGS_SPI_CLOCK_DEF,
+        p_settings ? p_settings->spi_clock : SETTINGS_SPI_CLOCK_DEF,
+        key_map_text, HALL_SCANNER_CHANNELS_PER_AD_CHIP,
+        SETTINGS_OUTPUT_DELAY_MAX, SETTINGS_OUTPUT_DELAY_MAX,
+        p_settings ? p_settings->output_delay : SETTINGS_OUTPUT_DELAY_DEF,
+        p_settings ? p_settings->output_delay : SETTINGS_OUTPUT_DELAY_DEF,
+        filter_options,
+        key_filter_names[filter_mode < KEY_FILTER_COUNT ? filter_mode : SETTINGS_FILTER_MODE_DEF],
+        (p_settings && p_settings->velocity_mode == MIDI_VELOCITY_MODE_AREA) ? " selected" : "",
+        (p_settings && p_settings->velocity_mode == MIDI_VELOCITY_MODE_TIME_OF_FLIGHT) ? " selected" : "",
+        (p_settings && p_settings->velocity_mode == MIDI_VELOCITY_MODE_TIME_OF_FLIGHT) ? "Time of flight" : "Area",
+        velocity_curve_options,
+        velocity_curve_names[velocity_curve < VELOCITY_CURVE_COUNT ? velocity_curve : SETTINGS_VELOCITY_CURVE_DEF],
+        VELOCITY_CURVE_USER_POINTS, velocity_points_text,
         calibration_active ? "disabled" : "",
         DEV_NAME, DEV_NAME,
         calibration_active ? "show" : "",
@@ -173,6 +292,64 @@ static int extract_param_value(const char *params, const char *name, char *value
     return 1;
 }
 
+// Parses the key map form value, see format_key_map(). Spaces come as '+' and commas
+// as %2C. Returns 0 unless there is one entry for every key.
+static int parse_key_map(const char *text, uint8_t *key_map) {
+    const char *p = text;
+    for (int i = 0; i < MIDI_NO_TONES; ++i) {
+        while (*p == '+' || *p == ' ') p++;
+        if (*p == '-') {
+            key_map[i] = SETTINGS_KEY_MAP_UNMAPPED;
+            p++;
+        } else if (*p >= '0' && *p <= '9') {
+            char *end;
+            long input = strtol(p, &end, 10);
+            if (input >= SETTINGS_KEY_MAP_UNMAPPED) return 0;
+            key_map[i] = (uint8_t)input;
+            p = end;
+        } else {
+            return 0;
+        }
+        while (*p == '+' || *p == ' ') p++;
+
+        if (i == MIDI_NO_TONES - 1) break;
+        if (*p == ',') {
+            p++;
+        } else if (strncmp(p, "%2C", 3) == 0 || strncmp(p, "%2c", 3) == 0) {
+            p += 3;
+        } else {
+            return 0;
+        }
+    }
+    return *p == '\0';
+}
+
+// Parses the user velocity curve form value, see format_velocity_points().
+// Returns 0 unless there is one velocity for every point.
+static int parse_velocity_points(const char *text, uint8_t *points) {
+    const char *p = text;
+    for (int i = 0; i < VELOCITY_CURVE_USER_POINTS; ++i) {
+        while (*p == '+' || *p == ' ') p++;
+        if (*p < '0' || *p > '9') return 0;
+        char *end;
+        long velocity = strtol(p, &end, 10);
+        if (velocity > 127) return 0;
+        points[i] = (uint8_t)velocity;
+        p = end;
+        while (*p == '+' || *p == ' ') p++;
+
+        if (i == VELOCITY_CURVE_USER_POINTS - 1) break;
+        if (*p == ',') {
+            p++;
+        } else if (strncmp(p, "%2C", 3) == 0 || strncmp(p, "%2c", 3) == 0) {
+            p += 3;
+        } else {
+            return 0;
+        }
+    }
+    return *p == '\0';
+}
+
 static int process_settings_form(const char *params) {
     if (!params || !p_settings) {
         printf("ERROR: process_settings_form called with NULL params or p_settings\n");
@@ -195,10 +372,10 @@ static int process_settings_form(const char *params) {
         }
     }
     
-    // Parse Base MIDI Note (0-127)
+    // Parse Base MIDI Note, the top key has to stay within the MIDI notes
     if (extract_param_value(params, "m_base", value_str, sizeof(value_str))) {
         value = atoi(value_str);
-        if (value >= 0 && value <= 127) {
+        if (value >= 0 && value <= SETTINGS_M_BASE_MAX) {
             p_settings->m_base = (uint8_t)value;
             settings_changed = true;
             printf("Updated base MIDI note to: %d\n", value);
@@ -214,7 +391,93 @@ static int process_settings_form(const char *params) {
             printf("Updated fast MIDI to: %d\n", value);
         }
     }
+
+    // Parse scan rate (Hz)
+    if (extract_param_value(params, "scan_rate", value_str, sizeof(value_str))) {
+        value = atoi(value_str);
+        if (value >= SETTINGS_SCAN_RATE_MIN && value <= SETTINGS_SCAN_RATE_MAX) {
+            p_settings->scan_rate = (uint16_t)value;
+            settings_changed = true;
+            printf("Updated scan rate to: %d\n", value);
+        }
+    }
+
+    // Parse maximal SPI clock (kHz)
+    if (extract_param_value(params, "spi_clock", value_str, sizeof(value_str))) {
+        value = atoi(value_str);
+        if (value >= SETTINGS_SPI_CLOCK_MIN && value <= SETTINGS_SPI_CLOCK_MAX) {
+            p_settings->spi_clock = (uint16_t)value;
+            settings_changed = true;
+            printf("Updated SPI clock to: %d\n", value);
+        }
+    }
+
+    // Parse fixed output latency (us)
+    if (extract_param_value(params, "output_delay", value_str, sizeof(value_str))) {
+        value = atoi(value_str);
+        if (value >= 0 && value <= SETTINGS_OUTPUT_DELAY_MAX) {
+            p_settings->output_delay = (uint16_t)value;
+            settings_changed = true;
+            printf("Updated output delay to: %d\n", value);
+        }
+    }
+
+    // Parse key map (applied after restart)
+    char key_map_str[KEY_MAP_PARAM_SIZE];
+    if (extract_param_value(params, "key_map", key_map_str, sizeof(key_map_str))) {
+        uint8_t key_map[MIDI_NO_TONES];
+        if (parse_key_map(key_map_str, key_map) && settings_key_map_valid(key_map)) {
+            memcpy(p_settings->key_map, key_map, sizeof(key_map));
+            settings_changed = true;
+            printf("Updated key map\n");
+        } else {
+            printf("WARNING: Invalid key map ignored: %s\n", key_map_str);
+        }
+    }
     
+    // Parse key filter (applied after restart)
+    if (extract_param_value(params, "filter_mode", value_str, sizeof(value_str))) {
+        value = atoi(value_str);
+        if (value >= 0 && value < KEY_FILTER_COUNT) {
+            p_settings->filter_mode = (uint8_t)value;
+            settings_changed = true;
+            printf("Updated filter mode to: %d\n", value);
+        }
+    }
+
+    // Parse velocity measurement (applied after restart)
+    if (extract_param_value(params, "velocity_mode", value_str, sizeof(value_str))) {
+        value = atoi(value_str);
+        if (value >= 0 && value < MIDI_VELOCITY_MODE_COUNT) {
+            p_settings->velocity_mode = (uint8_t)value;
+            settings_changed = true;
+            printf("Updated velocity mode to: %d\n", value);
+        }
+    }
+
+    // Parse velocity curve (applied after restart)
+    if (extract_param_value(params, "velocity_curve", value_str, sizeof(value_str))) {
+        value = atoi(value_str);
+        if (value >= 0 && value < VELOCITY_CURVE_COUNT) {
+            p_settings->velocity_curve = (uint8_t)value;
+            settings_changed = true;
+            printf("Updated velocity curve to: %d\n", value);
+        }
+    }
+
+    // Parse user velocity curve points (applied after restart)
+    char velocity_points_str[VELOCITY_POINTS_PARAM_SIZE];
+    if (extract_param_value(params, "velocity_user_curve", velocity_points_str, sizeof(velocity_points_str))) {
+        uint8_t points[VELOCITY_CURVE_USER_POINTS];
+        if (parse_velocity_points(velocity_points_str, points) && velocity_curve_user_valid(points)) {
+            memcpy(p_settings->velocity_user_curve, points, sizeof(points));
+            settings_changed = true;
+            printf("Updated user velocity curve\n");
+        } else {
+            printf("WARNING: Invalid user velocity curve ignored: %s\n", velocity_points_str);
+        }
+    }
+
     // Handle calibration commands
     if (extract_param_value(params, "calibrate", value_str, sizeof(value_str))) {
         if (strcmp(value_str, "start") == 0) {
@@ -253,6 +516,14 @@ static int test_server_content(const char *request, const char *params, char *re
             p_settings->fast_midi = SETTINGS_FAST_MIDI_DEF;
             p_settings->m_ch = SETTINGS_M_CH_DEF;
             p_settings->m_base = SETTINGS_M_BASE_DEF;
+            p_settings->scan_rate = SETTINGS_SCAN_RATE_DEF;
+            p_settings->spi_clock = SETTINGS_SPI_CLOCK_DEF;
+            settings_key_map_default(p_settings->key_map);
+            p_settings->output_delay = SETTINGS_OUTPUT_DELAY_DEF;
+            p_settings->velocity_curve = SETTINGS_VELOCITY_CURVE_DEF;
+            velocity_curve_user_default(p_settings->velocity_user_curve);
+            p_settings->velocity_mode = SETTINGS_VELOCITY_MODE_DEF;
+            p_settings->filter_mode = SETTINGS_FILTER_MODE_DEF;
             settings_save(p_settings);
         }
         // Handle form submission with settings
@@ -626,6 +897,8 @@ int wifi_ap_proc(SETTINGS *set) {
     while(1) {
         // Poll for WiFi and lwIP work
         cyw43_arch_poll();
+        // USB stdio, there is no background task (CMakeLists.txt)
+        tud_task();
         
         // Handle calibration loop
         if (calibration_active) {
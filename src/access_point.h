@@ -5,6 +5,7 @@
 
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
+#include "tusb.h"
 
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
@@ -22,7 +23,20 @@
 #define POLL_TIME_S 5
 #define HTTP_GET "GET"
 #define HTTP_RESPONSE_HEADERS "HTTP/1.1 %d OK\nContent-Length: %d\nContent-Type: text/html; charset=utf-8\nConnection: close\n\n"
-#define HTML_RESULT_SIZE 8192
+// The page and its headers are written at once, keep it below TCP_SND_BUF (lwipopts.h).
+// The longest page is about 7.8 KB (every setting at its widest), the rest is headroom
+// for further settings. 10240 + HTTP_HEADERS_MAX_SIZE still fits 8 segments (11680 B).
+#define HTML_RESULT_SIZE 10240
+// Response headers written with the page, about 125 B
+#define HTTP_HEADERS_MAX_SIZE 256
+// Key map as comma separated inputs, up to "254," per key (commas are sent as %2C)
+#define KEY_MAP_TEXT_SIZE (MIDI_NO_TONES * 4 + 1)
+#define KEY_MAP_PARAM_SIZE (MIDI_NO_TONES * 6 + 1)
+// User velocity curve as comma separated velocities, up to "127," per point
+#define VELOCITY_POINTS_TEXT_SIZE (VELOCITY_CURVE_USER_POINTS * 4 + 1)
+#define VELOCITY_POINTS_PARAM_SIZE (VELOCITY_CURVE_USER_POINTS * 6 + 1)
+// <option> elements of a select, up to 64 characters per option
+#define SELECT_OPTIONS_SIZE(count) ((count) * 64)
 #define SET_URL_SEGMENT "/settings"
 #define LED_GPIO 0
 #define HTTP_RESPONSE_REDIRECT "HTTP/1.1 302 Redirect\nLocation: http://%s" SET_URL_SEGMENT "\n\n"
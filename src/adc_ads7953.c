@@ -0,0 +1,51 @@
+#include "adc_driver.h"
+#include "hardware/gpio.h"
+
+// ADS7953 16-bit frames, MSB first
+// DI: bits 15-12 mode, bit 11 program bits 10-0, bit 10 reset channel counter (Auto-1),
+//     bit 6 input range (1 = 2 x VREF), bit 4 channel address on DO
+// DO: bits 15-12 channel address, bits 11-0 result
+#define ADS7953_MODE_CONTINUE 0x0000
+#define ADS7953_MODE_AUTO_1 0x2000
+#define ADS7953_AUTO_1_PROGRAM 0x8000
+#define ADS7953_PROGRAM 0x0800
+#define ADS7953_RESET_COUNTER 0x0400
+#define ADS7953_RANGE_2X_VREF 0x0040
+
+static void ads7953_frame(spi_inst_t *spi, uint cs_pin, uint16_t word) {
+    uint8_t tx_buf[2] = {word >> 8, word & 0xFF};
+    gpio_put(cs_pin, 0);
+    spi_write_blocking(spi, tx_buf, 2);
+    gpio_put(cs_pin, 1);
+}
+
+// Program the Auto-1 channel sequence and enter Auto-1 mode.
+// From then on the chip converts the next mapped channel in every frame.
+static void ads7953_chip_init(spi_inst_t *spi, uint cs_pin, uint16_t channel_mask) {
+    ads7953_frame(spi, cs_pin, ADS7953_AUTO_1_PROGRAM);
+    ads7953_frame(spi, cs_pin, channel_mask);
+    ads7953_frame(spi, cs_pin, ADS7953_MODE_AUTO_1 | ADS7953_PROGRAM | ADS7953_RESET_COUNTER | ADS7953_RANGE_2X_VREF);
+}
+
+// Every conversion keeps the mode, no per-channel command
+static void ads7953_build_cmd(uint8_t channel, uint8_t *tx_buf) {
+    tx_buf[0] = ADS7953_MODE_CONTINUE >> 8;
+    tx_buf[1] = ADS7953_MODE_CONTINUE & 0xFF;
+}
+
+// The result arrives two frames after its sample was taken, the channel address tells which one it is
+static uint16_t ads7953_decode(const uint8_t *rx_buf, uint8_t *channel) {
+    *channel = rx_buf[0] >> 4;
+    return ((rx_buf[0] & 0x0F) << 8) | rx_buf[1];  // 12-bit value (0-4095)
+}
+
+const AdcDriver adc_ads7953 = {
+    .name = "ADS7953",
+    .frame_bytes = 2,
+    .auto_sequence = true,
+    .pio_read_bits = 0,
+    .result_lag = 2,
+    .chip_init = ads7953_chip_init,
+    .build_cmd = ads7953_build_cmd,
+    .decode = ads7953_decode,
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/spi.h"
+
+// Largest SPI transaction of one conversion among the drivers
+#define ADC_MAX_FRAME_BYTES 3
+// Largest result_lag among the drivers
+#define ADC_MAX_RESULT_LAG 2
+
+// ADC chip driver used by the hall scanner engines
+// Blocking and DMA engines send build_cmd() bytes and decode() the received bytes,
+// the PIO engine runs the MCP3x08 bit protocol itself and needs pio_read_bits only.
+typedef struct {
+    const char *name;
+    uint8_t frame_bytes;        // SPI bytes per conversion, CS stays low for all of them
+    bool auto_sequence;         // Chip walks its channels itself, every conversion sends the same command
+    uint8_t pio_read_bits;      // Bits clocked in by mcp3008_scan.pio after the command, 0 - PIO not supported
+    // Conversions between a sample and its result. The scanner appends this many conversions
+    // to the sweep of each chip and drops the first results of the sweep, which belong to
+    // the previous one, so every input is sampled and read within its own frame.
+    uint8_t result_lag;
+
+    // Optional one-time chip setup, CS is driven by GPIO at that time.
+    // channel_mask holds the channels that are scanned, auto-sequencing chips walk only these.
+    void (*chip_init)(spi_inst_t *spi, uint cs_pin, uint16_t channel_mask);
+    // SPI bytes of one conversion of the channel
+    void (*build_cmd)(uint8_t channel, uint8_t *tx);
+    // Result of one conversion. channel holds the requested channel and it is
+    // overwritten when the chip reports which channel the result belongs to.
+    uint16_t (*decode)(const uint8_t *rx, uint8_t *channel);
+} AdcDriver;
+
+// MCP3008 (10-bit, 8 channels) and MCP3208 (12-bit, 8 channels)
+extern const AdcDriver adc_mcp3008;
+extern const AdcDriver adc_mcp3208;
+
+// ADS7953 (12-bit, 16 channels) in Auto-1 mode
+extern const AdcDriver adc_ads7953;
@@ -0,0 +1,52 @@
+#include "adc_driver.h"
+
+//--- MCP3008 ---
+// Send: 1 byte start (0x01), 1 byte command, 1 byte dummy
+// Command byte: bit 7 = single/diff, bits 6-4 = channel, bits 3-0 = don't care
+static void mcp3008_build_cmd(uint8_t channel, uint8_t *tx_buf) {
+    tx_buf[0] = 0x01;  // Start bit
+    tx_buf[1] = 0x80 | (channel << 4);  // Single-ended mode + channel select
+    tx_buf[2] = 0x00;  // Dummy byte
+}
+
+// Extract 10-bit result from rx_buf[1] and rx_buf[2]
+// MCP3008 returns: rx_buf[1] = X X X X X X b9 b8, rx_buf[2] = b7 b6 b5 b4 b3 b2 b1 b0
+static uint16_t mcp3008_decode(const uint8_t *rx_buf, uint8_t *channel) {
+    return ((rx_buf[1] & 0x03) << 8) | rx_buf[2];  // 10-bit value (0-1023)
+}
+
+const AdcDriver adc_mcp3008 = {
+    .name = "MCP3008",
+    .frame_bytes = 3,
+    .auto_sequence = false,
+    .pio_read_bits = 12,  // sample, null, B9..B0
+    .result_lag = 0,
+    .chip_init = NULL,
+    .build_cmd = mcp3008_build_cmd,
+    .decode = mcp3008_decode,
+};
+
+//--- MCP3208 ---
+// Same protocol with the command bits moved so that the 12-bit result ends in the last byte
+// Send: 0 0 0 0 0 start SGL D2 | D1 D0 X X X X X X | dummy
+static void mcp3208_build_cmd(uint8_t channel, uint8_t *tx_buf) {
+    tx_buf[0] = 0x06 | ((channel >> 2) & 0x01);  // Start bit, single-ended mode, D2
+    tx_buf[1] = (channel & 0x03) << 6;           // D1, D0
+    tx_buf[2] = 0x00;                            // Dummy byte
+}
+
+// MCP3208 returns: rx_buf[1] = X X X 0 b11 b10 b9 b8, rx_buf[2] = b7 .. b0
+static uint16_t mcp3208_decode(const uint8_t *rx_buf, uint8_t *channel) {
+    return ((rx_buf[1] & 0x0F) << 8) | rx_buf[2];  // 12-bit value (0-4095)
+}
+
+const AdcDriver adc_mcp3208 = {
+    .name = "MCP3208",
+    .frame_bytes = 3,
+    .auto_sequence = false,
+    .pio_read_bits = 14,  // sample, null, B11..B0
+    .result_lag = 0,
+    .chip_init = NULL,
+    .build_cmd = mcp3208_build_cmd,
+    .decode = mcp3208_decode,
+};
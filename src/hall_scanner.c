@@ -1,62 +1,800 @@
 #include "hall_scanner.h"
+#include "adc_driver.h"
 #include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/structs/io_bank0.h"
 #include "pico/stdlib.h"
+#include "pico/time.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static const uint8_t cs_pins[8] = HALL_SCANNER_CS_PINS;
-
-void hall_scanner_init(void) {
-    // No shared state, no critical section needed
-    spi_init(HALL_SCANNER_SPI_PORT, 1000 * 1000); // 1 MHz
-    gpio_set_function(16, GPIO_FUNC_SPI); // MISO
-    gpio_set_function(18, GPIO_FUNC_SPI); // SCK
-    gpio_set_function(19, GPIO_FUNC_SPI); // MOSI
-    for (int i = 0; i < 8; ++i) {
-        gpio_init(cs_pins[i]);
-        gpio_set_dir(cs_pins[i], GPIO_OUT);
-        gpio_put(cs_pins[i], 1);
-    }
-}
-
-static uint16_t mcp3008_read_channel(int chip_index, int channel) {
-    // MCP3008 SPI protocol:
-    // Send: 1 byte start (0x01), 1 byte command, 1 byte dummy
-    // Command byte: bit 7 = start bit, bit 6 = single/diff, bits 5-3 = channel, bits 2-0 = don't care
-    
-    uint8_t tx_buf[3];
-    uint8_t rx_buf[3];
-    
-    tx_buf[0] = 0x01;  // Start bit
-    tx_buf[1] = 0x80 | (channel << 4);  // Single-ended mode + channel select
-    tx_buf[2] = 0x00;  // Dummy byte
-    
-    gpio_put(cs_pins[chip_index], 0);  // Select chip
-    spi_write_read_blocking(HALL_SCANNER_SPI_PORT, tx_buf, rx_buf, 3);
-    gpio_put(cs_pins[chip_index], 1);  // Deselect chip
-    
-    // Extract 10-bit result from rx_buf[1] and rx_buf[2]
-    // MCP3008 returns: rx_buf[1] = X X X X X b9 b8 b7, rx_buf[2] = b6 b5 b4 b3 b2 b1 b0 X
-    uint16_t result = ((rx_buf[1] & 0x03) << 8) | rx_buf[2];
-    
-    return result;  // 10-bit value (0-1023)
+#if HALL_SCANNER_MODE == HALL_SCANNER_MODE_PIO
+#include "hardware/pio.h"
+#include "mcp3008_scan.pio.h"
+#endif
+
+//--- SPI buses ---
+// Each bus has its own engine, all buses convert their part of the frame at the same time
+#define BUS_MAX_AD_CHIPS 8
+// Slots of a plan, room for the trailing conversions of every chip (result_lag in adc_driver.h)
+#define BUS_MAX_SLOTS (BUS_MAX_AD_CHIPS * (HALL_SCANNER_CHANNELS_PER_AD_CHIP + ADC_MAX_RESULT_LAG))
+#define BUS_MAX_CONVERSIONS (BUS_MAX_SLOTS * HALL_SCANNER_OVERSAMPLE)
+
+#if HALL_SCANNER_BUS0_NUM_AD_CHIPS > BUS_MAX_AD_CHIPS || HALL_SCANNER_BUS1_NUM_AD_CHIPS > BUS_MAX_AD_CHIPS
+#error "Up to 8 ADC chips per SPI bus are supported"
+#endif
+
+#if HALL_SCANNER_NUM_CHANNELS > 255
+#error "Channel numbers have to fit into uint8_t"
+#endif
+
+static const AdcDriver *const adc = &HALL_SCANNER_ADC_DRIVER;
+
+// Duration of the conversions of the last frame
+static volatile uint32_t frame_time_us = 0;
+
+// SCK frequency of all buses, chosen by the self-test in hall_scanner_init()
+static uint32_t spi_clock_hz = 1000 * 1000;
+
+typedef struct {
+    spi_inst_t *spi;
+    uint8_t num_chips;
+    uint8_t first_input;  // ADC input number of the first channel on this bus
+    uint8_t cs_pins[BUS_MAX_AD_CHIPS];
+    uint8_t cs_base_pin;
+    uint8_t miso_pin;
+    uint8_t sck_pin;
+    uint8_t mosi_pin;
+} ScanBus;
+
+static const ScanBus buses[HALL_SCANNER_NUM_BUSES] = {
+    {HALL_SCANNER_BUS0_SPI_PORT, HALL_SCANNER_BUS0_NUM_AD_CHIPS, 0,
+     HALL_SCANNER_BUS0_CS_PINS, HALL_SCANNER_BUS0_CS_BASE_PIN,
+     HALL_SCANNER_BUS0_MISO_PIN, HALL_SCANNER_BUS0_SCK_PIN, HALL_SCANNER_BUS0_MOSI_PIN},
+#if HALL_SCANNER_NUM_BUSES > 1
+    {HALL_SCANNER_BUS1_SPI_PORT, HALL_SCANNER_BUS1_NUM_AD_CHIPS,
+     HALL_SCANNER_BUS0_NUM_AD_CHIPS * HALL_SCANNER_CHANNELS_PER_AD_CHIP,
+     HALL_SCANNER_BUS1_CS_PINS, HALL_SCANNER_BUS1_CS_BASE_PIN,
+     HALL_SCANNER_BUS1_MISO_PIN, HALL_SCANNER_BUS1_SCK_PIN, HALL_SCANNER_BUS1_MOSI_PIN},
+#endif
+};
+
+static inline int bus_num_channels(int bus) {
+    return buses[bus].num_chips * HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+}
+
+//--- Key map ---
+// Mapped inputs of one bus in conversion order. Inputs are sorted, so the
+// chips are walked one after another like the auto-sequencing chips expect.
+typedef struct {
+    uint8_t count;
+    uint8_t input[BUS_MAX_SLOTS];
+} ScanList;
+
+static ScanList scan_lists[HALL_SCANNER_NUM_BUSES];
+static uint8_t scan_bus_mask = 0;  // Bit per bus with at least one mapped input
+
+// Key of each ADC input, HALL_SCANNER_UNMAPPED for inputs that are never converted
+static uint8_t input_key[HALL_SCANNER_NUM_CHANNELS];
+
+static void key_map_apply(const uint8_t *key_map, uint8_t num_keys) {
+    bool mapped = false;
+    memset(input_key, HALL_SCANNER_UNMAPPED, sizeof(input_key));
+    // Keys index the activity mask and the latest values
+    if (num_keys > HALL_SCANNER_NUM_CHANNELS) num_keys = HALL_SCANNER_NUM_CHANNELS;
+
+    for (uint8_t key = 0; key < num_keys; ++key) {
+        uint8_t input = key_map ? key_map[key] : key;
+        if (input >= HALL_SCANNER_NUM_CHANNELS) continue;
+        if (input_key[input] != HALL_SCANNER_UNMAPPED) {
+            printf("WARNING: ADC input %d is mapped to keys %d and %d, key %d ignored\n",
+                   input, input_key[input], key, key);
+            continue;
+        }
+        input_key[input] = key;
+        mapped = true;
+    }
+    if (!mapped) {
+        printf("WARNING: No key is mapped to an ADC input, scanning all inputs\n");
+        for (int input = 0; input < HALL_SCANNER_NUM_CHANNELS; ++input) {
+            input_key[input] = input;
+        }
+    }
+
+    scan_bus_mask = 0;
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        ScanList *list = &scan_lists[bus];
+        list->count = 0;
+        for (int i = 0; i < bus_num_channels(bus); ++i) {
+            uint8_t input = buses[bus].first_input + i;
+            if (input_key[input] != HALL_SCANNER_UNMAPPED) list->input[list->count++] = input;
+        }
+        if (list->count) scan_bus_mask |= 1u << bus;
+    }
+}
+
+// Mapped channels of one chip
+static uint16_t chip_channel_mask(const ScanBus *bus, int chip_index) {
+    uint8_t first = bus->first_input + chip_index * HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+    uint16_t mask = 0;
+    for (int ch = 0; ch < HALL_SCANNER_CHANNELS_PER_AD_CHIP; ++ch) {
+        if (input_key[first + ch] != HALL_SCANNER_UNMAPPED) mask |= 1u << ch;
+    }
+    return mask;
+}
+
+// Decodes one conversion. input holds the planned ADC input, it is updated
+// when an auto-sequencing chip reports that the result belongs to another channel.
+static inline uint16_t bus_decode(int bus, const uint8_t *rx_buf, uint8_t *input) {
+    uint8_t planned = (*input - buses[bus].first_input) % HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+    uint8_t chip_channel = planned;
+    uint16_t value = adc->decode(rx_buf, &chip_channel);
+    *input = *input - planned + chip_channel;
+    return value;
+}
+
+// One value out of a burst of HALL_SCANNER_OVERSAMPLE conversions of the same channel
+static inline uint16_t decimate(uint16_t *burst) {
+#if HALL_SCANNER_OVERSAMPLE == 1
+    return burst[0];
+#elif HALL_SCANNER_DECIMATION == HALL_SCANNER_DECIMATION_MEDIAN
+    // Insertion sort, bursts are short
+    for (int i = 1; i < HALL_SCANNER_OVERSAMPLE; ++i) {
+        uint16_t v = burst[i];
+        int j = i;
+        for (; j > 0 && burst[j - 1] > v; --j) {
+            burst[j] = burst[j - 1];
+        }
+        burst[j] = v;
+    }
+    return burst[HALL_SCANNER_OVERSAMPLE / 2];
+#else
+    uint32_t sum = 0;
+    for (int i = 0; i < HALL_SCANNER_OVERSAMPLE; ++i) {
+        sum += burst[i];
+    }
+    return ((sum << HALL_SCANNER_OVERSAMPLE_BITS) + HALL_SCANNER_OVERSAMPLE / 2) / HALL_SCANNER_OVERSAMPLE;
+#endif
+}
+
+// SPI peripheral and chip selects of one bus driven by the CPU or DMA.
+// The PIO engine takes the pins over after the self-test.
+static void bus_spi_init(const ScanBus *bus) {
+    spi_init(bus->spi, spi_clock_hz);
+    gpio_set_function(bus->miso_pin, GPIO_FUNC_SPI);
+    gpio_set_function(bus->sck_pin, GPIO_FUNC_SPI);
+    gpio_set_function(bus->mosi_pin, GPIO_FUNC_SPI);
+    for (int i = 0; i < bus->num_chips; ++i) {
+        gpio_init(bus->cs_pins[i]);
+        gpio_set_dir(bus->cs_pins[i], GPIO_OUT);
+        gpio_put(bus->cs_pins[i], 1);
+        // Chips without mapped inputs are never selected
+        uint16_t channel_mask = chip_channel_mask(bus, i);
+        if (adc->chip_init && channel_mask) adc->chip_init(bus->spi, bus->cs_pins[i], channel_mask);
+    }
+}
+
+// input is the ADC input number, see bus_decode()
+static uint16_t adc_read_channel(int bus, uint8_t *input) {
+    const ScanBus *b = &buses[bus];
+    uint8_t local = *input - b->first_input;
+    uint8_t chip_index = local / HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+    uint8_t tx_buf[ADC_MAX_FRAME_BYTES];
+    uint8_t rx_buf[ADC_MAX_FRAME_BYTES];
+
+    adc->build_cmd(local % HALL_SCANNER_CHANNELS_PER_AD_CHIP, tx_buf);
+
+    gpio_put(b->cs_pins[chip_index], 0);  // Select chip
+    spi_write_read_blocking(b->spi, tx_buf, rx_buf, adc->frame_bytes);
+    gpio_put(b->cs_pins[chip_index], 1);  // Deselect chip
+
+    return bus_decode(bus, rx_buf, input);
+}
+
+//--- SPI clock self-test ---
+// Every mapped input is read at stepped SCK frequencies. The slowest step gives the reference
+// readings, a faster step is stable when all readings stay within the tolerance of them.
+// Keys rest during boot, so a disturbed reading means a corrupted transfer.
+#define SELF_TEST_READS 4
+#define SELF_TEST_TOLERANCE ((HALL_SCANNER_ADC_MAX_VALUE + 1) / 128)
+
+static const uint32_t self_test_steps_khz[] = {500, 1000, 1350, 1800, 2400, 3000, 3600, 5000, 8000, 12000, 16000, 20000};
+
+static bool self_test_step(bool reference_step) {
+    static uint16_t reference[HALL_SCANNER_NUM_CHANNELS];
+    bool stable = true;
+
+    for (int r = 0; r < SELF_TEST_READS; ++r) {
+        for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+            for (int i = 0; i < scan_lists[bus].count; ++i) {
+                uint8_t input = scan_lists[bus].input[i];
+                uint16_t value = adc_read_channel(bus, &input);
+                if (reference_step) {
+                    reference[input] = value;
+                } else if (abs((int)value - (int)reference[input]) > SELF_TEST_TOLERANCE) {
+                    stable = false;
+                }
+            }
+        }
+    }
+    return stable;
 }
 
+// Returns the fastest stable SCK frequency not above max_hz
+static uint32_t self_test_spi_clock(uint32_t max_hz) {
+    uint32_t chosen = 0;
+
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        spi_clock_hz = self_test_steps_khz[0] * 1000;
+        bus_spi_init(&buses[bus]);
+    }
+
+    for (unsigned i = 0; i < sizeof(self_test_steps_khz) / sizeof(self_test_steps_khz[0]); ++i) {
+        uint32_t hz = self_test_steps_khz[i] * 1000;
+        if (hz > max_hz) hz = max_hz;
+        if (hz <= chosen) break;
+
+        for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+            spi_set_baudrate(buses[bus].spi, hz);
+        }
+        if (!self_test_step(i == 0)) {
+            printf("WARNING: SPI self-test failed at %u Hz\n", hz);
+            break;
+        }
+        chosen = hz;
+    }
+
+    return chosen ? chosen : max_hz;
+}
+
+//--- Scan plan ---
+// Ordered list of inputs converted on one bus in one frame. It is a full sweep of the mapped inputs unless
+// activity scan is enabled and some keys are moving: then each moving key gets several
+// conversions spread over the frame and the idle keys share the rest of the frame,
+// so an idle key is converted once per HALL_SCANNER_IDLE_SWEEP_FRAMES frames.
+typedef struct {
+    uint8_t count;
+    uint8_t input[BUS_MAX_SLOTS];  // ADC input numbers
+    uint32_t start_us;  // time_us_32() when the frame was started
+    uint32_t end_us;    // time_us_32() when the frame IRQ saw the last conversion
+} ScanPlan;
+
+static inline bool same_chip(uint8_t input_a, uint8_t input_b) {
+    return input_a / HALL_SCANNER_CHANNELS_PER_AD_CHIP == input_b / HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+}
+
+// Written by the consumer core, read when a frame starts. A torn read affects one frame only.
+static volatile HallScannerKeyMask active_keys;
+
+static void build_plan(ScanPlan *plan, int bus) {
+    const ScanList *list = &scan_lists[bus];
+    uint8_t num = list->count;
+    plan->count = 0;
+
+#if HALL_SCANNER_ACTIVITY_SCAN
+    static uint8_t idle_cursor[HALL_SCANNER_NUM_BUSES];
+    HallScannerKeyMask active = active_keys;
+    uint8_t hot[BUS_MAX_SLOTS];
+    uint8_t hot_count = 0;
+    // Auto-sequencing chips convert in chip order only
+    if (!adc->auto_sequence) {
+        for (uint8_t i = 0; i < num; ++i) {
+            if (hall_scanner_mask_test(&active, input_key[list->input[i]])) hot[hot_count++] = list->input[i];
+        }
+    }
+
+    if (hot_count > 0) {
+        uint8_t idle_count = num - hot_count;
+        uint8_t idle_left = (idle_count + HALL_SCANNER_IDLE_SWEEP_FRAMES - 1) / HALL_SCANNER_IDLE_SWEEP_FRAMES;
+        uint8_t repeat = (num - idle_left) / hot_count;
+        if (repeat > HALL_SCANNER_ACTIVE_REPEAT_MAX) repeat = HALL_SCANNER_ACTIVE_REPEAT_MAX;
+        if (repeat < 1) repeat = 1;
+
+        uint8_t cursor = idle_cursor[bus];
+        for (uint8_t r = 0; r < repeat; ++r) {
+            for (uint8_t i = 0; i < hot_count; ++i) {
+                plan->input[plan->count++] = hot[i];
+            }
+            // Spread the idle conversions evenly between the rounds
+            uint8_t idle_now = idle_left / (repeat - r);
+            for (uint8_t i = 0; i < idle_now; ++i) {
+                while (hall_scanner_mask_test(&active, input_key[list->input[cursor]])) {
+                    cursor = (cursor + 1) % num;
+                }
+                plan->input[plan->count++] = list->input[cursor];
+                cursor = (cursor + 1) % num;
+            }
+            idle_left -= idle_now;
+        }
+        idle_cursor[bus] = cursor;
+        return;
+    }
+#endif
+
+    for (uint8_t i = 0; i < num; ++i) {
+        uint8_t input = list->input[i];
+        plan->input[plan->count++] = input;
+        // Trailing conversions after the last input of a chip push its last results out
+        if (i + 1 == num || !same_chip(list->input[i + 1], input)) {
+            for (uint8_t k = 0; k < adc->result_lag; ++k) {
+                plan->input[plan->count++] = input;
+            }
+        }
+    }
+}
+
+// Results of a lagging chip belong to the sample result_lag slots earlier,
+// the first result_lag results of a chip come from the trailing conversions of the previous frame.
+// Returns the slot sampled for the result of slot i, -1 if the result is dropped.
+static inline int plan_result_slot(const uint8_t *input, uint8_t i, uint8_t *chip_start) {
+    if (i == 0 || !same_chip(input[i], input[i - 1])) *chip_start = i;
+    if (i < *chip_start + adc->result_lag) return -1;
+    return i - adc->result_lag;
+}
+
+#if HALL_SCANNER_MODE != HALL_SCANNER_MODE_BLOCKING
+
+//--- Ping-pong frame state shared by the background engines, owned by the frame IRQ ---
+static ScanPlan plans[2][HALL_SCANNER_NUM_BUSES];
+static volatile uint8_t fill_index = 0;
+static volatile uint8_t ready_index = 0;
+static volatile uint32_t frame_seq = 0;
+static volatile uint8_t busy_buses = 0;  // Bit per bus still converting the current frame
+
+static void engine_start_frame(int bus, const ScanPlan *plan);
+static inline uint16_t engine_sample(int bus, uint8_t frame, int conv, uint8_t *input);
+
+// Background engines run the conversions at a constant pace, so the middle of
+// conversion i is interpolated between the frame start and end
+// (a burst of an oversampled slot is timed by its middle as well)
+static inline uint32_t plan_sample_time(const ScanPlan *plan, uint8_t conv) {
+    uint32_t span = plan->end_us - plan->start_us;
+    return plan->start_us + (span * (2u * conv + 1u)) / (2u * plan->count);
+}
+
+// Called from the frame IRQ, the frame is complete when the last bus finishes
+static void bus_frame_complete(int bus) {
+    plans[fill_index][bus].end_us = time_us_32();
+    busy_buses &= ~(1u << bus);
+    if (busy_buses) return;
+
+    frame_time_us = plans[fill_index][bus].end_us - plans[fill_index][0].start_us;
+    ready_index = fill_index;
+    fill_index ^= 1;
+    __dmb();
+    frame_seq++;
+}
+
+#endif
+
+#if HALL_SCANNER_MODE == HALL_SCANNER_MODE_DMA
+
+//--- DMA scan engine ---
+// Four channels per bus cooperate without CPU help during a frame:
+//   ctrl - copies one control block per trigger into the poke channel registers
+//   poke - executes the block: drives CS through the IO_BANK0 output override
+//          or starts tx/rx through MULTI_CHAN_TRIGGER
+//   tx   - feeds the command bytes of one conversion into the SPI FIFO
+//   rx   - drains the result bytes into the frame buffer and chains back to ctrl
+// SIO is not visible to DMA, that is why CS is driven by IO_BANK0 override.
+#define DMA_BLOCKS_PER_CONVERSION 3  // assert CS, transfer, release CS
+#define DMA_FRAME_BYTES (BUS_MAX_CONVERSIONS * ADC_MAX_FRAME_BYTES)
+#define DMA_FRAME_BLOCKS (BUS_MAX_CONVERSIONS * DMA_BLOCKS_PER_CONVERSION)
+
+// Layout matches the poke channel registers in alias 0 (CTRL_TRIG last)
+typedef struct {
+    const volatile void *read_addr;
+    volatile void *write_addr;
+    uint32_t trans_count;
+    uint32_t ctrl_trig;
+} DmaControlBlock;
+
+typedef struct {
+    int ctrl_chan, poke_chan, tx_chan, rx_chan;
+    uint32_t rxtx_trigger_mask;
+    // Poke channel CTRL values: CS blocks, transfer start block, last block of the frame
+    uint32_t cs_ctrl, start_ctrl, last_ctrl;
+    DmaControlBlock control_blocks[DMA_FRAME_BLOCKS];
+    uint8_t tx_cmds[DMA_FRAME_BYTES];
+    uint8_t rx_frames[2][DMA_FRAME_BYTES];
+} DmaBusEngine;
+
+static DmaBusEngine dma_engines[HALL_SCANNER_NUM_BUSES];
+
+// Values written into GPIOx_CTRL of the chip select pins
+static uint32_t cs_select_ctrl;
+static uint32_t cs_release_ctrl;
+
+// Command bytes and control blocks follow the plan, they are rebuilt for every frame
+static void engine_start_frame(int bus, const ScanPlan *plan) {
+    DmaBusEngine *e = &dma_engines[bus];
+    int conversions = plan->count * HALL_SCANNER_OVERSAMPLE;
+    for (int i = 0; i < conversions; ++i) {
+        uint8_t local = plan->input[i / HALL_SCANNER_OVERSAMPLE] - buses[bus].first_input;
+        uint8_t chip = local / HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+        uint8_t ch = local % HALL_SCANNER_CHANNELS_PER_AD_CHIP;
+        volatile uint32_t *cs_reg = &io_bank0_hw->io[buses[bus].cs_pins[chip]].ctrl;
+
+        adc->build_cmd(ch, &e->tx_cmds[i * adc->frame_bytes]);
+
+        DmaControlBlock *cb = &e->control_blocks[i * DMA_BLOCKS_PER_CONVERSION];
+        cb[0] = (DmaControlBlock){&cs_select_ctrl, cs_reg, 1, e->cs_ctrl};
+        cb[1] = (DmaControlBlock){&e->rxtx_trigger_mask, &dma_hw->multi_channel_trigger, 1, e->start_ctrl};
+        cb[2] = (DmaControlBlock){&cs_release_ctrl, cs_reg, 1, e->cs_ctrl};
+    }
+    e->control_blocks[conversions * DMA_BLOCKS_PER_CONVERSION - 1].ctrl_trig = e->last_ctrl;
+
+    dma_channel_set_read_addr(e->tx_chan, e->tx_cmds, false);
+    dma_channel_set_write_addr(e->rx_chan, e->rx_frames[fill_index], false);
+    dma_channel_set_read_addr(e->ctrl_chan, e->control_blocks, true);
+}
+
+// Result of conversion conv (counted with the oversampled bursts)
+static inline uint16_t engine_sample(int bus, uint8_t frame, int conv, uint8_t *input) {
+    return bus_decode(bus, &dma_engines[bus].rx_frames[frame][conv * adc->frame_bytes], input);
+}
+
+static void __isr dma_frame_done_handler(void) {
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        if (dma_channel_get_irq1_status(dma_engines[bus].poke_chan)) {
+            dma_channel_acknowledge_irq1(dma_engines[bus].poke_chan);
+            bus_frame_complete(bus);
+        }
+    }
+}
+
+static uint32_t poke_ctrl_value(const DmaBusEngine *e, bool chain_to_ctrl, bool last) {
+    dma_channel_config c = dma_channel_get_default_config(e->poke_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    // Chaining to itself means no chaining - rx channel continues the sequence
+    channel_config_set_chain_to(&c, chain_to_ctrl ? e->ctrl_chan : e->poke_chan);
+    // Only the very last block of the frame raises the IRQ
+    channel_config_set_irq_quiet(&c, !last);
+    return channel_config_get_ctrl_value(&c);
+}
+
+static void engine_init_bus(int bus) {
+    const ScanBus *b = &buses[bus];
+    DmaBusEngine *e = &dma_engines[bus];
+    bus_spi_init(b);
+
+    e->ctrl_chan = dma_claim_unused_channel(true);
+    e->poke_chan = dma_claim_unused_channel(true);
+    e->tx_chan = dma_claim_unused_channel(true);
+    e->rx_chan = dma_claim_unused_channel(true);
+
+    e->rxtx_trigger_mask = (1u << e->tx_chan) | (1u << e->rx_chan);
+    e->cs_ctrl = poke_ctrl_value(e, true, false);
+    e->start_ctrl = poke_ctrl_value(e, false, false);
+    e->last_ctrl = poke_ctrl_value(e, false, true);
+
+    // ctrl: 4 words per block into poke alias 0, write address wraps every 16 bytes
+    dma_channel_config c = dma_channel_get_default_config(e->ctrl_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 4);
+    dma_channel_configure(e->ctrl_chan, &c, &dma_hw->ch[e->poke_chan].read_addr, e->control_blocks, 4, false);
+
+    // tx: retriggered per conversion, keeps walking tx_cmds
+    c = dma_channel_get_default_config(e->tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, spi_get_dreq(b->spi, true));
+    dma_channel_configure(e->tx_chan, &c, &spi_get_hw(b->spi)->dr, e->tx_cmds,
+                          adc->frame_bytes, false);
+
+    // rx: retriggered per conversion, keeps walking the frame buffer, wakes ctrl when the conversion is done
+    c = dma_channel_get_default_config(e->rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, spi_get_dreq(b->spi, false));
+    channel_config_set_chain_to(&c, e->ctrl_chan);
+    dma_channel_configure(e->rx_chan, &c, e->rx_frames[0], &spi_get_hw(b->spi)->dr,
+                          adc->frame_bytes, false);
+
+    dma_channel_set_irq1_enabled(e->poke_chan, true);
+}
+
+static void engine_init(void) {
+    cs_select_ctrl = (GPIO_OVERRIDE_LOW << IO_BANK0_GPIO0_CTRL_OUTOVER_LSB) | GPIO_FUNC_SIO;
+    cs_release_ctrl = (GPIO_OVERRIDE_HIGH << IO_BANK0_GPIO0_CTRL_OUTOVER_LSB) | GPIO_FUNC_SIO;
+
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        engine_init_bus(bus);
+    }
+    irq_set_exclusive_handler(HALL_SCANNER_DMA_IRQ, dma_frame_done_handler);
+    irq_set_enabled(HALL_SCANNER_DMA_IRQ, true);
+}
+
+#elif HALL_SCANNER_MODE == HALL_SCANNER_MODE_PIO
+
+//--- PIO scan engine ---
+// One state machine per bus runs whole MCP3x08 transactions including CS (see mcp3008_scan.pio).
+// tx channel feeds one command word per conversion, rx channel collects one result
+// word per conversion and raises the frame IRQ when the bus part of the frame is complete.
+typedef struct {
+    uint sm;
+    int tx_chan, rx_chan;
+    uint32_t tx_words[BUS_MAX_CONVERSIONS];
+    uint32_t rx_frames[2][BUS_MAX_CONVERSIONS];
+} PioBusEngine;
+
+static PioBusEngine pio_engines[HALL_SCANNER_NUM_BUSES];
+
+// Command word of the state machine, see mcp3008_scan.pio
+static uint32_t mcp3008_pio_word(int chip_index, int channel) {
+    uint32_t cs_pattern = 0xFFu & ~(1u << chip_index);
+    uint32_t cmd = 0x03                  // Start bit, single-ended mode
+        | (((channel >> 2) & 1) << 2)    // D2
+        | (((channel >> 1) & 1) << 3)    // D1
+        | ((channel & 1) << 4);          // D0
+    uint32_t read_bits = adc->pio_read_bits - 1u;
+    return cs_pattern | (cmd << 8) | (read_bits << 13);
+}
+
+static void engine_start_frame(int bus, const ScanPlan *plan) {
+    PioBusEngine *e = &pio_engines[bus];
+    int conversions = plan->count * HALL_SCANNER_OVERSAMPLE;
+    for (int i = 0; i < conversions; ++i) {
+        uint8_t local = plan->input[i / HALL_SCANNER_OVERSAMPLE] - buses[bus].first_input;
+        e->tx_words[i] = mcp3008_pio_word(local / HALL_SCANNER_CHANNELS_PER_AD_CHIP,
+                                          local % HALL_SCANNER_CHANNELS_PER_AD_CHIP);
+    }
+    dma_channel_set_trans_count(e->rx_chan, conversions, false);
+    dma_channel_set_write_addr(e->rx_chan, e->rx_frames[fill_index], true);
+    dma_channel_set_trans_count(e->tx_chan, conversions, false);
+    dma_channel_set_read_addr(e->tx_chan, e->tx_words, true);
+}
+
+static inline uint16_t engine_sample(int bus, uint8_t frame, int conv, uint8_t *input) {
+    return pio_engines[bus].rx_frames[frame][conv] & HALL_SCANNER_ADC_MAX_VALUE;
+}
+
+static void __isr pio_frame_done_handler(void) {
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        if (dma_channel_get_irq1_status(pio_engines[bus].rx_chan)) {
+            dma_channel_acknowledge_irq1(pio_engines[bus].rx_chan);
+            bus_frame_complete(bus);
+        }
+    }
+}
+
+static bool engine_init_bus(int bus, uint offset) {
+    const ScanBus *b = &buses[bus];
+    PioBusEngine *e = &pio_engines[bus];
+
+    for (int i = 0; i < b->num_chips; ++i) {
+        if (b->cs_pins[i] != b->cs_base_pin + i) {
+            printf("ERROR: PIO scan requires consecutive CS pins starting at GP%d\n", b->cs_base_pin);
+            return false;
+        }
+    }
+
+    e->sm = pio_claim_unused_sm(HALL_SCANNER_PIO, true);
+    mcp3008_scan_program_init(HALL_SCANNER_PIO, e->sm, offset, b->cs_base_pin, b->num_chips,
+                              b->sck_pin, b->miso_pin, spi_clock_hz);
+
+    e->tx_chan = dma_claim_unused_channel(true);
+    e->rx_chan = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(e->tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(HALL_SCANNER_PIO, e->sm, true));
+    dma_channel_configure(e->tx_chan, &c, &HALL_SCANNER_PIO->txf[e->sm], e->tx_words,
+                          BUS_MAX_CONVERSIONS, false);
+
+    c = dma_channel_get_default_config(e->rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(HALL_SCANNER_PIO, e->sm, false));
+    dma_channel_configure(e->rx_chan, &c, e->rx_frames[0], &HALL_SCANNER_PIO->rxf[e->sm],
+                          BUS_MAX_CONVERSIONS, false);
+
+    dma_channel_set_irq1_enabled(e->rx_chan, true);
+    return true;
+}
+
+static void engine_init(void) {
+    if (adc->pio_read_bits == 0) {
+        printf("ERROR: PIO scan does not support %s\n", adc->name);
+        return;
+    }
+
+    // All state machines share one copy of the program
+    uint offset = pio_add_program(HALL_SCANNER_PIO, &mcp3008_scan_program);
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        if (!engine_init_bus(bus, offset)) return;
+    }
+    irq_set_exclusive_handler(HALL_SCANNER_DMA_IRQ, pio_frame_done_handler);
+    irq_set_enabled(HALL_SCANNER_DMA_IRQ, true);
+}
+
+#else
+
+//--- Blocking fallback ---
+// Buses are converted one after another
+static void engine_init(void) {
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        bus_spi_init(&buses[bus]);
+    }
+}
+
+#endif
+
+//--- Fixed-rate frame scheduler ---
+// A repeating hardware alarm starts every frame, so the samples are evenly spaced
+// no matter how long the consumer spends on processing or printing.
+static repeating_timer_t frame_timer;
+static uint32_t frame_period_us;
+static volatile uint32_t frame_ticks = 0;
+static volatile uint32_t frames_started = 0;
+static volatile uint32_t missed_deadlines = 0;
+static volatile uint32_t skipped_frames = 0;
+
+static bool frame_timer_callback(repeating_timer_t *rt) {
+    frame_ticks++;
+#if HALL_SCANNER_MODE != HALL_SCANNER_MODE_BLOCKING
+    // Previous frame still running - this start is lost
+    if (busy_buses) {
+        missed_deadlines++;
+        return true;
+    }
+    busy_buses = scan_bus_mask;
+    frames_started++;
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        ScanPlan *plan = &plans[fill_index][bus];
+        build_plan(plan, bus);
+        plan->start_us = time_us_32();
+        // A bus without mapped inputs stays idle
+        if (plan->count) engine_start_frame(bus, plan);
+    }
+#endif
+    return true;
+}
+
+void hall_scanner_init(uint16_t frame_rate_hz, uint32_t max_spi_clock_hz, const uint8_t *key_map, uint8_t num_keys) {
+    key_map_apply(key_map, num_keys);
+    spi_clock_hz = self_test_spi_clock(max_spi_clock_hz);
+    engine_init();
+
+    if (frame_rate_hz == 0) frame_rate_hz = 1;
+    frame_period_us = 1000000u / frame_rate_hz;
+    // Negative delay - period is measured between callback starts
+    add_repeating_timer_us(-(int64_t)frame_period_us, frame_timer_callback, NULL, &frame_timer);
+}
+
+void hall_scanner_get_stats(HallScannerStats *stats) {
+    stats->frame_period_us = frame_period_us;
+    stats->frame_time_us = frame_time_us;
+    stats->spi_clock_hz = spi_clock_hz;
+    stats->frames = frames_started;
+    stats->missed_deadlines = missed_deadlines;
+    stats->skipped_frames = skipped_frames;
+}
+
+void hall_scanner_set_active_keys(const HallScannerKeyMask *mask) {
+    active_keys = *mask;
+}
+
+#if HALL_SCANNER_MODE == HALL_SCANNER_MODE_BLOCKING
+
+void hall_scanner_read_frame(HallScannerFrame *frame) {
+    static uint32_t consumed_ticks = 0;
+    static ScanPlan plan;
+
+    // Wait for the next frame start, ticks that passed meanwhile are missed deadlines
+    while (frame_ticks == consumed_ticks) {
+        tight_loop_contents();
+    }
+    uint32_t ticks = frame_ticks;
+    if (ticks - consumed_ticks > 1) {
+        missed_deadlines += ticks - consumed_ticks - 1;
+    }
+    consumed_ticks = ticks;
+    frames_started++;
+
+    frame->count = 0;
+    frame->start_us = time_us_32();
+    for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+        uint32_t slot_us[BUS_MAX_SLOTS];
+        uint8_t chip_start = 0;
+        build_plan(&plan, bus);
+        for (uint8_t i = 0; i < plan.count; ++i) {
+            uint16_t burst[HALL_SCANNER_OVERSAMPLE];
+            uint8_t input;
+            uint32_t burst_start = time_us_32();
+            for (int k = 0; k < HALL_SCANNER_OVERSAMPLE; ++k) {
+                input = plan.input[i];
+                burst[k] = adc_read_channel(bus, &input);
+            }
+            slot_us[i] = burst_start + (time_us_32() - burst_start) / 2;
+            int sampled = plan_result_slot(plan.input, i, &chip_start);
+            if (sampled < 0 || input_key[input] == HALL_SCANNER_UNMAPPED) continue;
+
+            uint8_t n = frame->count++;
+            frame->channel[n] = input_key[input];
+            frame->time_us[n] = slot_us[sampled];
+            frame->value[n] = decimate(burst);
+        }
+    }
+    frame_time_us = time_us_32() - frame->start_us;
+}
+
+#else
+
+void hall_scanner_read_frame(HallScannerFrame *frame) {
+    static uint32_t last_seq = 0;
+
+    // Wait for a frame that was not returned yet
+    while (frame_seq == last_seq) {
+        tight_loop_contents();
+    }
+    // Frames completed but never picked up by the consumer
+    if (frame_seq - last_seq > 1) {
+        skipped_frames += frame_seq - last_seq - 1;
+    }
+
+    // The frame IRQ hands the buffer back to the engine when the next frame completes - retry then
+    uint32_t seq;
+    do {
+        seq = frame_seq;
+        __dmb();
+        uint8_t index = ready_index;
+        frame->count = 0;
+        frame->start_us = plans[index][0].start_us;
+        // Merge the buses into one frame
+        for (int bus = 0; bus < HALL_SCANNER_NUM_BUSES; ++bus) {
+            const ScanPlan *plan = &plans[index][bus];
+            uint8_t chip_start = 0;
+            for (uint8_t i = 0; i < plan->count; ++i) {
+                int sampled = plan_result_slot(plan->input, i, &chip_start);
+                if (sampled < 0) continue;
+                uint16_t burst[HALL_SCANNER_OVERSAMPLE];
+                uint8_t input;
+                for (int k = 0; k < HALL_SCANNER_OVERSAMPLE; ++k) {
+                    input = plan->input[i];
+                    burst[k] = engine_sample(bus, index, i * HALL_SCANNER_OVERSAMPLE + k, &input);
+                }
+                // Auto-sequencing chips may report an input out of the map after the mode change
+                if (input_key[input] == HALL_SCANNER_UNMAPPED) continue;
+
+                uint8_t n = frame->count++;
+                frame->channel[n] = input_key[input];
+                frame->time_us[n] = plan_sample_time(plan, sampled);
+                frame->value[n] = decimate(burst);
+            }
+        }
+        __dmb();
+    } while (seq != frame_seq);
+
+    last_seq = seq;
+}
+
+#endif
+
 void hall_scanner_read_all(uint16_t *values, uint8_t count) {
-    static uint32_t call_counter = 0;
-    uint8_t read_count = 0;
-    for (uint8_t chip = 0; chip < HALL_SCANNER_NUM_AD_CHIPS && read_count < count; ++chip) {
-        for (uint8_t ch = 0; ch < HALL_SCANNER_CHANNELS_PER_AD_CHIP && read_count < count; ++ch) {
-            values[read_count] = mcp3008_read_channel(chip, ch);
-            read_count++;
-        }
-    }
-    
-    // call_counter++;
-    // if (call_counter % 300 == 0) {
-    //     printf("Values: ");
-    //     for (uint8_t i = 0; i < read_count; ++i) {
-    //         printf("%u ", values[i]);
-    //     }
-    //     printf("\n");
-    // }
+    // Keys left out by an activity plan keep their last value
+    static uint16_t latest[HALL_SCANNER_NUM_CHANNELS];
+    static HallScannerFrame frame;
+
+    hall_scanner_read_frame(&frame);
+    for (uint8_t i = 0; i < frame.count; ++i) {
+        latest[frame.channel[i]] = frame.value[i];
+    }
+
+    if (count > HALL_SCANNER_NUM_CHANNELS) count = HALL_SCANNER_NUM_CHANNELS;
+    for (uint8_t i = 0; i < count; ++i) {
+        values[i] = latest[i];
+    }
 }
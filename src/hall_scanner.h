@@ -1,14 +1,210 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 #include "pico/critical_section.h"
 
-#define HALL_SCANNER_NUM_AD_CHIPS 8
+// ADC chip driver (see adc_driver.h)
+// MCP3008 - 10-bit, 8 channels, 3 SPI bytes per conversion
+// MCP3208 - 12-bit, 8 channels, 3 SPI bytes per conversion
+// ADS7953 - 12-bit, 16 channels, 2 SPI bytes per conversion, walks its channels itself (Auto-1)
+#define HALL_SCANNER_ADC_MCP3008 0
+#define HALL_SCANNER_ADC_MCP3208 1
+#define HALL_SCANNER_ADC_ADS7953 2
+
+#ifndef HALL_SCANNER_ADC
+#define HALL_SCANNER_ADC HALL_SCANNER_ADC_MCP3008
+#endif
+
+#if HALL_SCANNER_ADC == HALL_SCANNER_ADC_ADS7953
+#define HALL_SCANNER_ADC_DRIVER adc_ads7953
+#define HALL_SCANNER_CHANNELS_PER_AD_CHIP 16
+#define HALL_SCANNER_ADC_RESOLUTION_BITS 12
+#elif HALL_SCANNER_ADC == HALL_SCANNER_ADC_MCP3208
+#define HALL_SCANNER_ADC_DRIVER adc_mcp3208
 #define HALL_SCANNER_CHANNELS_PER_AD_CHIP 8
+#define HALL_SCANNER_ADC_RESOLUTION_BITS 12
+#else
+#define HALL_SCANNER_ADC_DRIVER adc_mcp3008
+#define HALL_SCANNER_CHANNELS_PER_AD_CHIP 8
+#define HALL_SCANNER_ADC_RESOLUTION_BITS 10
+#endif
+
+#define HALL_SCANNER_ADC_MAX_VALUE ((1 << HALL_SCANNER_ADC_RESOLUTION_BITS) - 1)
+
+// Burst oversampling
+// Every planned conversion becomes HALL_SCANNER_OVERSAMPLE back-to-back conversions
+// of the same channel, decimated into one value by the scanner.
+// AVERAGE - sum of the burst, keeps log2(N)/2 extra bits (N = 4: +1 bit, N = 16: +2 bits)
+// MEDIAN  - middle value of the burst, rejects spikes, no extra bits
+#define HALL_SCANNER_DECIMATION_AVERAGE 0
+#define HALL_SCANNER_DECIMATION_MEDIAN 1
+
+#ifndef HALL_SCANNER_OVERSAMPLE
+#define HALL_SCANNER_OVERSAMPLE 1
+#endif
+#ifndef HALL_SCANNER_DECIMATION
+#define HALL_SCANNER_DECIMATION HALL_SCANNER_DECIMATION_AVERAGE
+#endif
+
+#if HALL_SCANNER_OVERSAMPLE > 1 && HALL_SCANNER_ADC == HALL_SCANNER_ADC_ADS7953
+#error "ADS7953 in Auto-1 mode cannot convert one channel back-to-back"
+#endif
+
+#if HALL_SCANNER_DECIMATION == HALL_SCANNER_DECIMATION_AVERAGE && HALL_SCANNER_OVERSAMPLE >= 16
+#define HALL_SCANNER_OVERSAMPLE_BITS 2
+#elif HALL_SCANNER_DECIMATION == HALL_SCANNER_DECIMATION_AVERAGE && HALL_SCANNER_OVERSAMPLE >= 4
+#define HALL_SCANNER_OVERSAMPLE_BITS 1
+#else
+#define HALL_SCANNER_OVERSAMPLE_BITS 0
+#endif
+
+// Resolution of the values returned by the scanner
+#define HALL_SCANNER_RESOLUTION_BITS (HALL_SCANNER_ADC_RESOLUTION_BITS + HALL_SCANNER_OVERSAMPLE_BITS)
+#define HALL_SCANNER_MAX_VALUE ((1 << HALL_SCANNER_RESOLUTION_BITS) - 1)
+
+// Scales a value given for the 10-bit MCP3008 to the resolution of the scanner values
+#define HALL_SCANNER_SCALE_10BIT(value) ((value) << (HALL_SCANNER_RESOLUTION_BITS - 10))
+
+// The chips can be split over two SPI buses scanned at the same time.
+// ADC inputs are numbered chip by chip (chip x channels per chip + channel): bus 0 chips first, then bus 1 chips.
+// Example of an 88-key build: 2 buses, 6 chips on each bus, MIDI_NO_TONES 88
+// (or a single bus with 6 ADS7953 chips).
+#ifndef HALL_SCANNER_NUM_BUSES
+#define HALL_SCANNER_NUM_BUSES 1
+#endif
+
+// Bus 0 - SPI0, chip selects: GP2, GP3, ... GP9
+#ifndef HALL_SCANNER_BUS0_NUM_AD_CHIPS
+#define HALL_SCANNER_BUS0_NUM_AD_CHIPS 8
+#endif
+#define HALL_SCANNER_BUS0_SPI_PORT spi0
+#define HALL_SCANNER_BUS0_CS_PINS {2, 3, 4, 5, 6, 7, 8, 9}
+#define HALL_SCANNER_BUS0_MISO_PIN 16
+#define HALL_SCANNER_BUS0_SCK_PIN 18
+#define HALL_SCANNER_BUS0_MOSI_PIN 19  // PIO mode expects MOSI = SCK + 1
+
+// Bus 1 - SPI1, chip selects: GP10, GP11, ... GP15
+#ifndef HALL_SCANNER_BUS1_NUM_AD_CHIPS
+#define HALL_SCANNER_BUS1_NUM_AD_CHIPS 6
+#endif
+#define HALL_SCANNER_BUS1_SPI_PORT spi1
+#define HALL_SCANNER_BUS1_CS_PINS {10, 11, 12, 13, 14, 15}
+#define HALL_SCANNER_BUS1_MISO_PIN 28
+#define HALL_SCANNER_BUS1_SCK_PIN 26
+#define HALL_SCANNER_BUS1_MOSI_PIN 27
+
+// PIO mode drives the chip selects of a bus as one pin group, they have to be consecutive
+#define HALL_SCANNER_BUS0_CS_BASE_PIN 2
+#define HALL_SCANNER_BUS1_CS_BASE_PIN 10
+
+#if HALL_SCANNER_NUM_BUSES > 1
+#define HALL_SCANNER_NUM_AD_CHIPS (HALL_SCANNER_BUS0_NUM_AD_CHIPS + HALL_SCANNER_BUS1_NUM_AD_CHIPS)
+#else
+#define HALL_SCANNER_NUM_AD_CHIPS HALL_SCANNER_BUS0_NUM_AD_CHIPS
+#endif
+#define HALL_SCANNER_NUM_CHANNELS (HALL_SCANNER_NUM_AD_CHIPS * HALL_SCANNER_CHANNELS_PER_AD_CHIP)
 
-// SPI0, chip selects: GP2, GP3, ... GP9
-// Using MCP3008 (10-bit)
-#define HALL_SCANNER_SPI_PORT spi0
-#define HALL_SCANNER_CS_PINS {2, 3, 4, 5, 6, 7, 8, 9}
+// Acquisition engine
+// BLOCKING - CPU runs every conversion with spi_write_read_blocking() and toggles CS by gpio_put()
+// DMA      - chained DMA channels walk the mapped inputs on their own and fill ping-pong frame buffers
+// PIO      - PIO state machine drives CS, SCK, MOSI and MISO, fed and drained by two DMA channels
+#define HALL_SCANNER_MODE_BLOCKING 0
+#define HALL_SCANNER_MODE_DMA 1
+#define HALL_SCANNER_MODE_PIO 2
 
-void hall_scanner_init(void);
+// The PIO program speaks the MCP3x08 protocol only
+#ifndef HALL_SCANNER_MODE
+#if HALL_SCANNER_ADC == HALL_SCANNER_ADC_ADS7953
+#define HALL_SCANNER_MODE HALL_SCANNER_MODE_DMA
+#else
+#define HALL_SCANNER_MODE HALL_SCANNER_MODE_PIO
+#endif
+#endif
+
+#if HALL_SCANNER_MODE == HALL_SCANNER_MODE_PIO && HALL_SCANNER_ADC == HALL_SCANNER_ADC_ADS7953
+#error "ADS7953 needs the DMA or blocking scan mode"
+#endif
+
+// DMA and PIO engines raise this IRQ once per finished frame on each bus
+#define HALL_SCANNER_DMA_IRQ DMA_IRQ_1
+
+// PIO engine, the SCK frequency follows from the PIO clock divider
+#define HALL_SCANNER_PIO pio0
+
+// Activity-aware scanning
+// Keys reported as moving by hall_scanner_set_active_keys() get up to
+// HALL_SCANNER_ACTIVE_REPEAT_MAX conversions per frame, idle keys are swept
+// over HALL_SCANNER_IDLE_SWEEP_FRAMES frames. A frame never takes more conversions than a full sweep.
+// Auto-sequencing ADCs always run full sweeps.
+#ifndef HALL_SCANNER_ACTIVITY_SCAN
+#define HALL_SCANNER_ACTIVITY_SCAN 0
+#endif
+#define HALL_SCANNER_ACTIVE_REPEAT_MAX 4
+#define HALL_SCANNER_IDLE_SWEEP_FRAMES 4
+
+// Key map
+// key_map[key] is the ADC input of the key, HALL_SCANNER_UNMAPPED leaves the key without input.
+// Only mapped inputs are converted, so spare inputs cost no scan time and
+// keys do not have to follow the PCB wiring order.
+#define HALL_SCANNER_UNMAPPED 0xFF
+
+// Values per frame (planned conversions or decimated bursts), all buses together
+#define HALL_SCANNER_FRAME_SLOTS HALL_SCANNER_NUM_CHANNELS
+
+// One bit per key
+#define HALL_SCANNER_MASK_WORDS ((HALL_SCANNER_NUM_CHANNELS + 63) / 64)
+typedef struct {
+    uint64_t word[HALL_SCANNER_MASK_WORDS];
+} HallScannerKeyMask;
+
+static inline bool hall_scanner_mask_test(const HallScannerKeyMask *mask, int key) {
+    return (mask->word[key / 64] >> (key % 64)) & 1;
+}
+
+static inline void hall_scanner_mask_set(HallScannerKeyMask *mask, int key, bool on) {
+    if (on) {
+        mask->word[key / 64] |= 1ull << (key % 64);
+    } else {
+        mask->word[key / 64] &= ~(1ull << (key % 64));
+    }
+}
+
+// One acquisition frame - value[i] is a conversion of key channel[i], in conversion order on each bus.
+// Conversions of all buses are merged into one frame, bus 0 first.
+// A key may appear several times (moving key) or not at all (idle key) in activity scan.
+// Times are time_us_32() stamps: measured per conversion in blocking mode,
+// derived from the frame start/end and the constant conversion pace in DMA and PIO mode.
+typedef struct {
+    uint8_t count;
+    uint32_t start_us;
+    uint8_t channel[HALL_SCANNER_FRAME_SLOTS];
+    uint16_t value[HALL_SCANNER_FRAME_SLOTS];
+    uint32_t time_us[HALL_SCANNER_FRAME_SLOTS];
+} HallScannerFrame;
+
+// Scan statistics of the fixed-rate frame scheduler
+typedef struct {
+    uint32_t spi_clock_hz;      // SCK frequency chosen by the self-test
+    uint32_t frame_time_us;     // Duration of the conversions of the last frame
+    uint32_t frame_period_us;   // Period of the frame start alarm
+    uint32_t frames;            // Frames started
+    uint32_t missed_deadlines;  // Frame starts lost because the previous frame was still running
+    uint32_t skipped_frames;    // Completed frames the consumer did not pick up in time
+} HallScannerStats;
+
+// Frames are started by a repeating hardware alarm at frame_rate_hz.
+// A self-test first picks the fastest SPI clock up to max_spi_clock_hz
+// at which all mapped inputs read consistently.
+// key_map holds the ADC input of num_keys keys, NULL maps key N to input N.
+void hall_scanner_init(uint16_t frame_rate_hz, uint32_t max_spi_clock_hz, const uint8_t *key_map, uint8_t num_keys);
+void hall_scanner_get_stats(HallScannerStats *stats);
+
+// Returns the newest complete frame. It waits until a frame newer than
+// the one returned by the previous call is available.
+void hall_scanner_read_frame(HallScannerFrame *frame);
+
+// Same as hall_scanner_read_frame(), but returns the latest value of each key
 void hall_scanner_read_all(uint16_t *values, uint8_t count);
+
+// Mask of keys in motion, used to plan the next frames in activity scan
+void hall_scanner_set_active_keys(const HallScannerKeyMask *mask);
@@ -0,0 +1,180 @@
+#include "key_filter.h"
+
+const char *const key_filter_names[KEY_FILTER_COUNT] = {
+    [KEY_FILTER_MOVING_AVERAGE] = "Moving average",
+    [KEY_FILTER_EMA] = "Exponential",
+    [KEY_FILTER_MEDIAN3] = "Median of 3",
+    [KEY_FILTER_ONE_EURO] = "One-Euro",
+};
+
+#define MIDI_MA_MASK (MIDI_MA_COUNT - 1)
+
+// Fixed point: EMA state in 1/256 units, One-Euro values in 1/16 units, smoothing factors in 1/4096
+#define EMA_FRAC_BITS 8
+#define ONE_EURO_FRAC_BITS 4
+#define ALPHA_BITS 12
+
+// One-Euro speed is kept in 1/16 units per ms, this shift turns it into 10-bit units per ms
+// (1000 units/s, the unit of KEY_FILTER_ONE_EURO_BETA)
+#define ONE_EURO_SPEED_SHIFT (ONE_EURO_FRAC_BITS + HALL_SCANNER_RESOLUTION_BITS - 10)
+// Speeds are clamped, so the fixed-point products stay within 32 bits
+#define ONE_EURO_SPEED_MAX (1 << 17)
+
+// Time constant 1 / (2 pi fc) of a low-pass with cutoff fc, in us
+#define LOWPASS_TAU_US(cutoff_hz) (159155u / (cutoff_hz))
+
+// Filter state, one array per field over the keys
+static struct {
+    // Moving average
+    uint16_t ma_buffer[MIDI_NO_TONES][MIDI_MA_COUNT];
+    uint32_t ma_sum[MIDI_NO_TONES];
+    uint8_t ma_index[MIDI_NO_TONES];
+    // EMA
+    int32_t ema[MIDI_NO_TONES];
+    // Median of 3, the last two conversions
+    uint16_t median_prev[MIDI_NO_TONES][2];
+    // One-Euro
+    int32_t one_euro_value[MIDI_NO_TONES];
+    int32_t one_euro_speed[MIDI_NO_TONES];
+    uint32_t one_euro_time_us[MIDI_NO_TONES];
+} filters, saved_filters, live_filters;
+
+static uint8_t filter_mode;
+
+void key_filter_init(uint8_t mode, const uint16_t *released_voltage) {
+    filter_mode = (mode < KEY_FILTER_COUNT) ? mode : KEY_FILTER_MOVING_AVERAGE;
+
+    for (int key = 0; key < MIDI_NO_TONES; key++) {
+        uint16_t released = released_voltage[key];
+
+        // Full moving average window, the average is a shift from the first conversion on
+        for (int i = 0; i < MIDI_MA_COUNT; i++) {
+            filters.ma_buffer[key][i] = released;
+        }
+        filters.ma_sum[key] = (uint32_t)released * MIDI_MA_COUNT;
+        filters.ma_index[key] = 0;
+
+        filters.ema[key] = (int32_t)released << EMA_FRAC_BITS;
+
+        filters.median_prev[key][0] = released;
+        filters.median_prev[key][1] = released;
+
+        filters.one_euro_value[key] = (int32_t)released << ONE_EURO_FRAC_BITS;
+        filters.one_euro_speed[key] = 0;
+        filters.one_euro_time_us[key] = 0;
+    }
+}
+
+// Moving average of one conversion of a key, the window is always full
+static inline uint16_t moving_average(int key, uint16_t raw_value) {
+    uint8_t index = filters.ma_index[key];
+    uint32_t sum = filters.ma_sum[key] - filters.ma_buffer[key][index] + raw_value;
+    filters.ma_buffer[key][index] = raw_value;
+    filters.ma_sum[key] = sum;
+    filters.ma_index[key] = (index + 1) & MIDI_MA_MASK;
+
+    // Rounded average, the division by a power of two is a shift
+    return (uint16_t)((sum + MIDI_MA_COUNT / 2) / MIDI_MA_COUNT);
+}
+
+static inline uint16_t exponential(int key, uint16_t raw_value) {
+    int32_t y = filters.ema[key];
+    y += (((int32_t)raw_value << EMA_FRAC_BITS) - y) >> KEY_FILTER_EMA_SHIFT;
+    filters.ema[key] = y;
+    return (uint16_t)((y + (1 << (EMA_FRAC_BITS - 1))) >> EMA_FRAC_BITS);
+}
+
+static inline uint16_t median3(int key, uint16_t raw_value) {
+    uint16_t a = raw_value;
+    uint16_t b = filters.median_prev[key][0];
+    uint16_t c = filters.median_prev[key][1];
+    filters.median_prev[key][1] = b;
+    filters.median_prev[key][0] = a;
+
+    uint16_t lo = (a < b) ? a : b;
+    uint16_t hi = (a < b) ? b : a;
+    if (c < lo) return lo;
+    if (c > hi) return hi;
+    return c;
+}
+
+// Smoothing factor of a first-order low-pass for one sample interval, in 1/4096
+static inline int32_t lowpass_alpha(uint32_t interval_us, uint32_t tau_us) {
+    return (int32_t)((interval_us << ALPHA_BITS) / (interval_us + tau_us));
+}
+
+// One-Euro filter: the key speed, low-passed at a fixed cutoff, raises the cutoff of the value low-pass.
+// The sample interval is taken from the conversion times, so it holds for any scan rate and activity scan.
+static inline uint16_t one_euro(int key, uint16_t raw_value, uint32_t time_us) {
+    uint32_t interval_us = time_us - filters.one_euro_time_us[key];
+    filters.one_euro_time_us[key] = time_us;
+    if (interval_us > KEY_FILTER_ONE_EURO_MAX_INTERVAL_US) interval_us = KEY_FILTER_ONE_EURO_MAX_INTERVAL_US;
+    if (interval_us == 0) interval_us = 1;
+
+    int32_t x = (int32_t)raw_value << ONE_EURO_FRAC_BITS;
+    int32_t x_hat = filters.one_euro_value[key];
+
+    // Speed in 1/16 units per ms
+    int32_t speed = (x - x_hat) * 1000 / (int32_t)interval_us;
+    if (speed > ONE_EURO_SPEED_MAX) speed = ONE_EURO_SPEED_MAX;
+    if (speed < -ONE_EURO_SPEED_MAX) speed = -ONE_EURO_SPEED_MAX;
+    int32_t speed_hat = filters.one_euro_speed[key];
+    speed_hat += ((speed - speed_hat) * lowpass_alpha(interval_us, LOWPASS_TAU_US(KEY_FILTER_ONE_EURO_SPEED_CUTOFF_HZ)))
+                 >> ALPHA_BITS;
+    filters.one_euro_speed[key] = speed_hat;
+
+    uint32_t abs_speed = (speed_hat < 0) ? (uint32_t)-speed_hat : (uint32_t)speed_hat;
+    uint32_t cutoff_hz = KEY_FILTER_ONE_EURO_MIN_CUTOFF_HZ + ((abs_speed * KEY_FILTER_ONE_EURO_BETA) >> ONE_EURO_SPEED_SHIFT);
+    if (cutoff_hz > KEY_FILTER_ONE_EURO_MAX_CUTOFF_HZ) cutoff_hz = KEY_FILTER_ONE_EURO_MAX_CUTOFF_HZ;
+
+    x_hat += ((x - x_hat) * lowpass_alpha(interval_us, LOWPASS_TAU_US(cutoff_hz))) >> ALPHA_BITS;
+    filters.one_euro_value[key] = x_hat;
+    return (uint16_t)((x_hat + (1 << (ONE_EURO_FRAC_BITS - 1))) >> ONE_EURO_FRAC_BITS);
+}
+
+// One loop per filter, the filter is not selected per conversion
+void key_filter_frame_mode(uint8_t mode, const HallScannerFrame *frame, uint16_t *filtered) {
+    switch (mode) {
+        case KEY_FILTER_EMA:
+            for (int i = 0; i < frame->count; i++) {
+                int key = frame->channel[i];
+                if (key < MIDI_NO_TONES) filtered[i] = exponential(key, frame->value[i]);
+            }
+            break;
+        case KEY_FILTER_MEDIAN3:
+            for (int i = 0; i < frame->count; i++) {
+                int key = frame->channel[i];
+                if (key < MIDI_NO_TONES) filtered[i] = median3(key, frame->value[i]);
+            }
+            break;
+        case KEY_FILTER_ONE_EURO:
+            for (int i = 0; i < frame->count; i++) {
+                int key = frame->channel[i];
+                if (key < MIDI_NO_TONES) filtered[i] = one_euro(key, frame->value[i], frame->time_us[i]);
+            }
+            break;
+        default:
+            for (int i = 0; i < frame->count; i++) {
+                int key = frame->channel[i];
+                if (key < MIDI_NO_TONES) filtered[i] = moving_average(key, frame->value[i]);
+            }
+            break;
+    }
+}
+
+void key_filter_frame(const HallScannerFrame *frame, uint16_t *filtered) {
+    key_filter_frame_mode(filter_mode, frame, filtered);
+}
+
+void key_filter_save(void) {
+    saved_filters = filters;
+}
+
+void key_filter_trial_begin(void) {
+    live_filters = filters;
+    filters = saved_filters;
+}
+
+void key_filter_trial_end(void) {
+    filters = live_filters;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include "hall_scanner.h"
+#include "midi_defs.h"
+
+// Filter stage between the scanner and the key states, one filter for all keys chosen in the settings.
+// MOVING_AVERAGE - mean of the last MIDI_MA_COUNT conversions
+// EMA            - exponential smoothing, y += (x - y) / 2^KEY_FILTER_EMA_SHIFT
+// MEDIAN3        - median of the last 3 conversions, rejects single-sample spikes
+// ONE_EURO       - adaptive low-pass (One-Euro filter): cutoff rises with the key speed,
+//                  smooths heavily at rest and hardly at all in motion
+#define KEY_FILTER_MOVING_AVERAGE 0
+#define KEY_FILTER_EMA 1
+#define KEY_FILTER_MEDIAN3 2
+#define KEY_FILTER_ONE_EURO 3
+#define KEY_FILTER_COUNT 4
+
+// Moving average window, has to be a power of two
+// Oversampled values are already decimated by the scanner, the average only adds delay then
+#if HALL_SCANNER_OVERSAMPLE > 1
+#define MIDI_MA_COUNT 1
+#else
+#define MIDI_MA_COUNT 2
+#endif
+
+#if MIDI_MA_COUNT & (MIDI_MA_COUNT - 1)
+#error "MIDI_MA_COUNT has to be a power of two"
+#endif
+
+// EMA smoothing factor 1/2^shift
+#define KEY_FILTER_EMA_SHIFT 1
+
+// One-Euro parameters
+// Cutoff at rest, cutoff increase per 1000 units/s of key speed (10-bit ADC units),
+// upper limit of the cutoff, cutoff of the speed estimate
+#define KEY_FILTER_ONE_EURO_MIN_CUTOFF_HZ 5
+#define KEY_FILTER_ONE_EURO_BETA 20
+#define KEY_FILTER_ONE_EURO_MAX_CUTOFF_HZ 5000
+#define KEY_FILTER_ONE_EURO_SPEED_CUTOFF_HZ 10
+// Longer sample intervals (idle keys in activity scan, first sample) count as this
+#define KEY_FILTER_ONE_EURO_MAX_INTERVAL_US 10000
+
+extern const char *const key_filter_names[KEY_FILTER_COUNT];
+
+// Selects the filter, the state of every key starts at its released voltage
+void key_filter_init(uint8_t mode, const uint16_t *released_voltage);
+
+// Filters the conversions of a frame in scan order, filtered[i] belongs to frame->value[i].
+// Conversions of channels from MIDI_NO_TONES up are skipped.
+void key_filter_frame(const HallScannerFrame *frame, uint16_t *filtered);
+
+// Same with the given filter instead of the selected one, for timing every filter on the same frame
+void key_filter_frame_mode(uint8_t mode, const HallScannerFrame *frame, uint16_t *filtered);
+
+// Benchmark runs: key_filter_save() copies the state of all filters before a frame,
+// between key_filter_trial_begin() and key_filter_trial_end() the filters run from that copy
+// and the live state is set aside
+void key_filter_save(void);
+void key_filter_trial_begin(void);
+void key_filter_trial_end(void);
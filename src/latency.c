@@ -0,0 +1,77 @@
+#include "latency.h"
+
+typedef struct {
+    uint32_t events;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t bucket[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+static LatencyHistogram histograms[LATENCY_STAGE_COUNT];
+
+const char *const latency_stage_names[LATENCY_STAGE_COUNT] = {
+    [LATENCY_DETECT] = "capture-to-change",
+    [LATENCY_QUEUE] = "change-to-post",
+    [LATENCY_HANDOFF] = "post-to-transmit",
+    [LATENCY_TOTAL] = "capture-to-transmit",
+};
+
+static int bucket_index(uint32_t us) {
+    if (us < LATENCY_SUB_BUCKETS) return us;
+    int msb = 31 - __builtin_clz(us);
+    return (msb - 2) * LATENCY_SUB_BUCKETS + ((us >> (msb - 3)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// Largest value falling into the bucket
+static uint32_t bucket_upper_us(int index) {
+    if (index < LATENCY_SUB_BUCKETS) return index;
+    int shift = index / LATENCY_SUB_BUCKETS - 1;
+    uint32_t lower = (uint32_t)(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+    return lower + ((1u << shift) - 1);
+}
+
+static void histogram_add(LatencyHistogram *h, uint32_t us) {
+    if (h->events == 0 || us < h->min_us) h->min_us = us;
+    if (us > h->max_us) h->max_us = us;
+    h->events++;
+    h->bucket[bucket_index(us)]++;
+}
+
+// Value below which percent % of the events fall
+static uint32_t histogram_percentile(const LatencyHistogram *h, uint32_t percent) {
+    uint32_t rank = (uint32_t)(((uint64_t)h->events * percent + 99) / 100);
+    if (rank == 0) rank = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            uint32_t upper = bucket_upper_us(i);
+            return upper < h->max_us ? upper : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+void latency_record(const MidiEvent *event, uint32_t transmit_us) {
+    histogram_add(&histograms[LATENCY_DETECT], event->change_us - event->capture_us);
+    histogram_add(&histograms[LATENCY_QUEUE], event->post_us - event->change_us);
+    histogram_add(&histograms[LATENCY_HANDOFF], transmit_us - event->post_us);
+    histogram_add(&histograms[LATENCY_TOTAL], transmit_us - event->capture_us);
+}
+
+void latency_reset(void) {
+    for (int i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+        histograms[i] = (LatencyHistogram){0};
+    }
+}
+
+void latency_get_summary(LatencyStage stage, LatencySummary *summary) {
+    const LatencyHistogram *h = &histograms[stage];
+    *summary = (LatencySummary){0};
+    if (h->events == 0) return;
+    summary->events = h->events;
+    summary->min_us = h->min_us;
+    summary->median_us = histogram_percentile(h, 50);
+    summary->p99_us = histogram_percentile(h, 99);
+    summary->max_us = h->max_us;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include "midi_ring.h"
+
+// Key-to-wire latency of the MIDI events, measured at four points:
+// capture  - conversion that crossed the threshold (scan frame)
+// change   - key state change seen by update_key_state() on core1
+// post     - event pushed into the ring by core1
+// transmit - bytes handed to the UART DMA and the USB frame batch by core0
+typedef enum {
+    LATENCY_DETECT = 0,  // capture to change - frame delivery and filtering
+    LATENCY_QUEUE,       // change to post - velocity, output order, deferred events
+    LATENCY_HANDOFF,     // post to transmit - ring, core0 wake-up, fixed output delay
+    LATENCY_TOTAL,       // capture to transmit
+    LATENCY_STAGE_COUNT
+} LatencyStage;
+
+// Histogram buckets: exact below 8 us, then 8 buckets per power of two (12.5 % resolution)
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS ((32 - 2) * LATENCY_SUB_BUCKETS)
+
+// Percentiles are the upper bound of their bucket, min and max are exact
+typedef struct {
+    uint32_t events;
+    uint32_t min_us;
+    uint32_t median_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} LatencySummary;
+
+extern const char *const latency_stage_names[LATENCY_STAGE_COUNT];
+
+// Core0 only, call when the event has been handed to the transports
+void latency_record(const MidiEvent *event, uint32_t transmit_us);
+void latency_reset(void);
+void latency_get_summary(LatencyStage stage, LatencySummary *summary);
@@ -1,8 +1,18 @@
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "tusb.h"
 #include "hall_scanner.h"
 #include "settings.h"
 #include "midi.h"
+#include "midi_uart.h"
+#include "midi_encode.h"
+#include "usb_midi.h"
+#include "midi_scheduler.h"
+#include "trace.h"
+#include "latency.h"
+#include "key_filter.h"
 #include "access_point.h"
 #include <stdio.h>
 
@@ -11,18 +21,222 @@
 ////////////////////////////
 SETTINGS main_settings;
 
-// critical code protection from concurrency
-critical_section_t cs_lock;
+// MIDI messages from core1 to core0, lock-free
+MidiRing midi_ring;
 
-// shared output buffer for MIDI events
-queue_t shared_midi_buff;
+// Sequence number checks of the received events
+uint32_t midi_expected_seq = 0;
+uint32_t midi_duplicate_events = 0;
+uint32_t midi_missing_events = 0;
 
 // WiFi button configuration
 #define WIFI_BUTTON_GPIO 22
 
 // Wrapper for midi_process to run on core1
 void midi_process_core1_entry() {
-    midi_process(&main_settings, &cs_lock, &shared_midi_buff);
+    midi_process(&main_settings, &midi_ring);
+}
+
+// Report missed scan deadlines, invoked periodically from the main loop
+void report_scan_stats() {
+    static uint32_t reported_missed = 0;
+    static uint32_t reported_skipped = 0;
+    HallScannerStats stats;
+    hall_scanner_get_stats(&stats);
+    if (stats.missed_deadlines != reported_missed || stats.skipped_frames != reported_skipped) {
+        printf("WARNING: scan period %u us, frames: %u, missed deadlines: %u, skipped frames: %u\n",
+               stats.frame_period_us, stats.frames, stats.missed_deadlines, stats.skipped_frames);
+        reported_missed = stats.missed_deadlines;
+        reported_skipped = stats.skipped_frames;
+    }
+}
+
+// Report MIDI events lost because core0 did not drain the ring in time
+void report_midi_stats() {
+    static uint32_t reported_dropped = 0;
+    uint32_t dropped = midi_ring.dropped;
+    if (dropped != reported_dropped) {
+        printf("WARNING: MIDI ring full, dropped events: %u\n", dropped);
+        reported_dropped = dropped;
+    }
+    static uint32_t reported_sequence_errors = 0;
+    if (midi_duplicate_events + midi_missing_events != reported_sequence_errors) {
+        printf("WARNING: MIDI event sequence, duplicates: %u, missing: %u\n",
+               midi_duplicate_events, midi_missing_events);
+        reported_sequence_errors = midi_duplicate_events + midi_missing_events;
+    }
+
+    if (midi_scheduler_enabled()) {
+        MidiSchedulerStats sched;
+        midi_scheduler_get_stats(&sched);
+        if (sched.events) {
+            printf("MIDI SCHEDULE: delay %u us, events %u, send error avg %u us, max %u us, late events %u\n",
+                   sched.delay_us, sched.events, (uint32_t)(sched.total_error_us / sched.events),
+                   sched.max_error_us, sched.late);
+        }
+        static uint32_t reported_overflows = 0;
+        if (sched.overflows != reported_overflows) {
+            printf("WARNING: MIDI scheduler full, events held in the ring: %u times\n", sched.overflows);
+            reported_overflows = sched.overflows;
+        }
+    }
+
+    static MidiOutputStats reported_output = {0};
+    MidiOutputStats output;
+    midi_get_output_stats(&output);
+    if (output.frames != reported_output.frames) {
+        MidiUartStats uart_stats;
+        midi_uart_get_stats(&uart_stats);
+        printf("MIDI OUT: event frames %u, backlog %u, max backlog %u, UART backlog %u bytes, deferred note-offs %u, note-ons %u\n",
+               output.frames - reported_output.frames, output.backlog, output.max_backlog, uart_stats.backlog,
+               output.deferred_note_offs, output.deferred_note_ons);
+        reported_output = output;
+    }
+
+    static uint32_t reported_uart_dropped = 0;
+    MidiUartStats uart_stats;
+    midi_uart_get_stats(&uart_stats);
+    if (uart_stats.dropped != reported_uart_dropped) {
+        printf("WARNING: MIDI UART ring full, dropped bytes: %u\n", uart_stats.dropped);
+        reported_uart_dropped = uart_stats.dropped;
+    }
+
+    static UsbMidiStats reported_usb = {0};
+    UsbMidiStats usb_stats;
+    usb_midi_get_stats(&usb_stats);
+    if (usb_stats.transfers != reported_usb.transfers) {
+        printf("USB MIDI: messages %u in %u transfers\n", usb_stats.messages - reported_usb.messages,
+               usb_stats.transfers - reported_usb.transfers);
+    }
+    if (usb_stats.dropped != reported_usb.dropped) {
+        printf("WARNING: USB MIDI FIFO full, dropped messages: %u\n", usb_stats.dropped);
+    }
+    reported_usb = usb_stats;
+}
+
+// Events are numbered by core1, returns false for a repeated number
+bool midi_check_sequence(const MidiEvent *event) {
+    int32_t ahead = (int32_t)(event->seq - midi_expected_seq);
+    if (ahead < 0) {
+        midi_duplicate_events++;
+        return false;
+    }
+    midi_missing_events += ahead;
+    midi_expected_seq = event->seq + 1;
+    return true;
+}
+
+// Serializes one event for the UART DMA and the USB frame batch, never waits for the transmission.
+// Notes above 127 are dropped, settings_load() keeps m_base low enough for all keys.
+void midi_output_send(const MidiEvent *event) {
+    uint8_t data[MIDI_MESSAGE_MAX_BYTES];
+    int length = midi_event_serialize(event, main_settings.m_ch, main_settings.m_base, data);
+    if (length == 0) return;
+    midi_uart_send(data, length);
+    usb_midi_send(data, length);
+    latency_record(event, time_us_32());
+}
+
+// Latency histograms of the events sent since boot or the last reset
+void report_latency() {
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; ++stage) {
+        LatencySummary summary;
+        latency_get_summary(stage, &summary);
+        printf("LATENCY %s: events %u, min %u us, median %u us, p99 %u us, max %u us\n",
+               latency_stage_names[stage], summary.events, summary.min_us, summary.median_us,
+               summary.p99_us, summary.max_us);
+    }
+}
+
+// Core1 processing cost per frame since the previous report
+void report_process_cost() {
+    static MidiProcessStats reported = {0};
+    MidiProcessStats stats;
+    midi_get_process_stats(&stats);
+    uint32_t frames = stats.frames - reported.frames;
+    if (frames) {
+        uint32_t avg = (stats.cycles - reported.cycles) / frames;
+        uint32_t cycles_per_us = clock_get_hz(clk_sys) / 1000000u;
+        printf("CORE1: frames %u, avg %u cycles (%u us), max %u cycles (%u us) per frame\n",
+               frames, avg, avg / cycles_per_us, stats.max_cycles, stats.max_cycles / cycles_per_us);
+        uint32_t filter_avg = (stats.filter_cycles - reported.filter_cycles) / frames;
+        printf("CORE1: filter %s, avg %u cycles (%u us), max %u cycles (%u us) per frame\n",
+               key_filter_names[main_settings.filter_mode], filter_avg, filter_avg / cycles_per_us,
+               stats.max_filter_cycles, stats.max_filter_cycles / cycles_per_us);
+    }
+    reported = stats;
+}
+
+// Cycles of every filter over the same frame from the same starting state, printed once core1 has run the benchmark
+void report_filter_benchmark() {
+    MidiFilterBenchmark result;
+    if (!midi_get_filter_benchmark(&result)) return;
+    uint32_t cycles_per_us = clock_get_hz(clk_sys) / 1000000u;
+    for (int mode = 0; mode < KEY_FILTER_COUNT; ++mode) {
+        printf("FILTER BENCHMARK: %s, %u cycles (%u us) for %u conversions%s\n",
+               key_filter_names[mode], result.cycles[mode], result.cycles[mode] / cycles_per_us,
+               result.conversions, (mode == main_settings.filter_mode) ? " (selected)" : "");
+    }
+}
+
+// Report the SPI clock chosen by the scanner self-test, the measured frame time
+// and the result of the MIDI UART self-test
+void report_scan_setup() {
+    HallScannerStats stats;
+    hall_scanner_get_stats(&stats);
+    printf("SCAN: SPI clock %u Hz, frame time %u us, frame period %u us\n",
+           stats.spi_clock_hz, stats.frame_time_us, stats.frame_period_us);
+    MidiUartStats uart_stats;
+    midi_uart_get_stats(&uart_stats);
+    if (uart_stats.loopback_ok) {
+        printf("MIDI: UART loopback OK at %u baud\n", uart_stats.baud);
+    } else {
+        printf("ERROR: MIDI UART loopback failed at %u baud\n", uart_stats.baud);
+    }
+}
+
+// USB is serviced from the main loop only, so the setup report waits for the console.
+// Printed whenever a terminal opens the CDC port.
+void report_scan_setup_on_connect() {
+    static bool connected = false;
+    bool now_connected = tud_cdc_connected();
+    if (now_connected && !connected) {
+        report_scan_setup();
+    }
+    connected = now_connected;
+}
+
+// Single-key commands from the USB console, never waits for input
+// l - print the latency histograms, r - reset them, p - core1 processing cost per frame,
+// b - time every filter over one frame, s - scanner and MIDI UART setup
+void console_poll() {
+    int c = getchar_timeout_us(0);
+    switch (c) {
+        case PICO_ERROR_TIMEOUT:
+        case '\r':
+        case '\n':
+            break;
+        case 'l':
+            report_latency();
+            break;
+        case 'r':
+            latency_reset();
+            printf("LATENCY: histograms reset\n");
+            break;
+        case 'p':
+            report_process_cost();
+            break;
+        case 'b':
+            midi_request_filter_benchmark();
+            break;
+        case 's':
+            report_scan_setup();
+            break;
+        default:
+            printf("Commands: l - latency histograms, r - reset latency histograms, p - processing cost, "
+                   "b - filter benchmark, s - scan setup\n");
+            break;
+    }
 }
 
 // Initialize and check WiFi button
@@ -51,9 +265,8 @@ int main() {
     
     printf("Starting RPico Hall Scanner...\n");
     
-    // Initialize MIDI queue and critical section lock
-    critical_section_init(&cs_lock);
-    queue_init(&shared_midi_buff, sizeof(uint8_t), MIDI_BUFFER_SIZE);
+    // Initialize MIDI ring
+    midi_ring_init(&midi_ring);
 
     // Load settings from flash
     settings_load(&main_settings);
@@ -75,8 +288,23 @@ int main() {
     for (int i = 0; i < MIDI_NO_TONES; ++i) {
         printf("%u%s", main_settings.pressed_voltage[i], (i < MIDI_NO_TONES-1) ? "," : "]\n");
     }
+    printf("  scan_rate: %u\n", main_settings.scan_rate);
+    printf("  spi_clock: %u\n", main_settings.spi_clock);
+    printf("  output_delay: %u\n", main_settings.output_delay);
+    printf("  key_map: [");
+    for (int i = 0; i < MIDI_NO_TONES; ++i) {
+        printf("%u%s", main_settings.key_map[i], (i < MIDI_NO_TONES-1) ? "," : "]\n");
+    }
+    printf("  filter_mode: %u\n", main_settings.filter_mode);
+    printf("  velocity_mode: %u\n", main_settings.velocity_mode);
+    printf("  velocity_curve: %u\n", main_settings.velocity_curve);
+    printf("  velocity_user_curve: [");
+    for (int i = 0; i < VELOCITY_CURVE_USER_POINTS; ++i) {
+        printf("%u%s", main_settings.velocity_user_curve[i], (i < VELOCITY_CURVE_USER_POINTS-1) ? "," : "]\n");
+    }
 
-    hall_scanner_init();
+    hall_scanner_init(main_settings.scan_rate, main_settings.spi_clock * 1000u,
+                      main_settings.key_map, MIDI_NO_TONES);
 
     // Initialize and check WiFi button  
     if (init_wifi_button()) {
@@ -102,21 +330,61 @@ int main() {
     sleep_ms(50);
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
 
+    // DIN and USB MIDI outputs, driven from core0
+    midi_uart_init(main_settings.fast_midi);
+    usb_midi_init();
+    midi_scheduler_init(main_settings.output_delay);
+
     // Launch midi_process on core1
     multicore_launch_core1(midi_process_core1_entry);
 
     // Main core loop
+    absolute_time_t next_report = make_timeout_time_ms(1000);
     while (true) {
-        // Lock critical section before accessing the queue
-        critical_section_enter_blocking(&cs_lock);
-        while (!queue_is_empty(&shared_midi_buff)) {
-            uint8_t val;
-            if (queue_try_remove(&shared_midi_buff, &val)) {
+        // Due events first, the slots they free take the events held in the ring
+        MidiEvent event;
+        while (midi_scheduler_pop_due(&event)) {
+            midi_output_send(&event);
+        }
+        // Drain the events, core1 keeps pushing meanwhile
+        while (midi_ring_count(&midi_ring)) {
+            // Fixed latency mode holds the event until capture time + output delay.
+            // A full scheduler leaves the events in the ring until midi_scheduler_pop_due()
+            // frees a slot. Core1 then defers new events, it does not drop them: a note-on waits
+            // for room for itself and the note-offs of all sounding notes, a note-off is retried
+            // (deferred_note_ons and deferred_note_offs in MidiOutputStats).
+            if (midi_scheduler_enabled() && midi_scheduler_full()) break;
+            if (!midi_ring_pop(&midi_ring, &event)) break;
+            if (!midi_check_sequence(&event)) continue;
+            if (midi_scheduler_enabled()) {
+                midi_scheduler_add(&event);
+            } else {
+                midi_output_send(&event);
             }
         }
-        critical_section_exit(&cs_lock);
-        // TODO: remove this
-        sleep_ms(10);
+        // USB device task, the only caller besides the tud_* calls of this loop
+        tud_task();
+        // Messages of the previous USB frame go out in one transfer
+        usb_midi_task();
+
+        // Trace records of both cores, printed as far as USB has room
+        trace_flush();
+        console_poll();
+        report_filter_benchmark();
+
+        if (time_reached(next_report)) {
+            report_scan_setup_on_connect();
+            report_scan_stats();
+            report_midi_stats();
+            next_report = make_timeout_time_ms(1000);
+        }
+
+        // Sleep until core1 pushes a message (__sev() in midi_ring_push()) or an interrupt
+        // arrives - the frame alarm of the scanner, USB controller transfers (not the start
+        // of frame), the scheduler alarm of the next due event and the USB MIDI alarm
+        // polling for the next USB frame while a batch is pending wake core0.
+        // A push after the drain above leaves the event latched, so __wfe() returns at once.
+        __wfe();
     }
 
     return 0;
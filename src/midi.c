@@ -1,93 +1,51 @@
 #include "midi.h"
+#include "trace.h"
+#include "velocity_curve.h"
+#include "key_filter.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
 
-//--- MIDI message sending functions ---
-bool midi_send_msg(uint8_t *data, int no_bytes, critical_section_t *cs, queue_t *buff) {
-    if (no_bytes <= 0 || no_bytes > MIDI_BUFFER_SIZE) return false;
-    bool success = true;
-    critical_section_enter_blocking(cs);
-    for (int i = 0; i < no_bytes; ++i) {
-        if (!queue_try_add(buff, &data[i])) {
-            success = false;
-            break;
-        }
-    }
-    critical_section_exit(cs);
-    return success;
-}
-
-bool midi_send_note_on(uint8_t channel, uint8_t midi_base, int input, uint8_t velocity, critical_section_t *cs, queue_t *buff) {
-    if (velocity > 127) velocity = 127;
-    if ((int)velocity < 0) velocity = 0;
-    uint8_t msg[3];
-    msg[0] = 0x90 | (channel & 0x0F); // Note On
-    msg[1] = midi_base + input;
-    msg[2] = velocity;
-    return midi_send_msg(msg, 3, cs, buff);
-}
+//--- MIDI event sending functions ---
+// Sequence number of the next event, taken only by events that made it into the ring
+static uint32_t next_seq = 0;
 
-bool midi_send_note_off(uint8_t channel, uint8_t midi_base, int input, critical_section_t *cs, queue_t *buff) {
-    uint8_t msg[3];
-    msg[0] = 0x80 | (channel & 0x0F); // Note Off
-    msg[1] = midi_base + input;
-    msg[2] = 0x00; // Velocity
-    return midi_send_msg(msg, 3, cs, buff);
+bool midi_send_event(MidiEvent *event, MidiRing *ring) {
+    event->seq = next_seq;
+    event->post_us = time_us_32();
+    if (!midi_ring_push(ring, event)) return false;
+    next_seq++;
+    return true;
 }
 
-//--- Moving Average to filter analog values for multiple channels ---
-typedef struct {
-    uint16_t buffer[MIDI_MA_COUNT];
-    int index;
-    int count;
-    uint32_t sum;
-} MovingAverage;
-
-// Array of moving averages for all channels
-static MovingAverage channel_filters[MIDI_NO_TONES];
-
-// Initialize all moving average structures
-void init_all_moving_averages(void) {
-    for (int ch = 0; ch < MIDI_NO_TONES; ch++) {
-        MovingAverage *ma = &channel_filters[ch];
-        for (int i = 0; i < MIDI_MA_COUNT; i++) {
-            ma->buffer[i] = 0;
-        }
-        ma->index = 0;
-        ma->count = 0;
-        ma->sum = 0;
-    }
+bool midi_send_note_on(int key, uint8_t velocity, uint32_t capture_us, uint32_t change_us, MidiRing *ring) {
+    if (velocity > 127) velocity = 127;
+    MidiEvent event = {
+        .type = MIDI_EVENT_NOTE_ON,
+        .key = (uint8_t)key,
+        .velocity = velocity,
+        .capture_us = capture_us,
+        .change_us = change_us,
+    };
+    return midi_send_event(&event, ring);
 }
 
-uint16_t moving_average_add(MovingAverage *ma, uint16_t new_value) {
-    // Input validation
-    if (!ma) return 0;
-    
-    // Subtract the oldest value from sum
-    ma->sum -= ma->buffer[ma->index];
-    
-    // Add the new value to the buffer and sum
-    ma->buffer[ma->index] = new_value;
-    ma->sum += new_value;
-    
-    // Update index (circular buffer)
-    ma->index = (ma->index + 1) % MIDI_MA_COUNT;
-    
-    // Update count (saturate at buffer size)
-    if (ma->count < MIDI_MA_COUNT) {
-        ma->count++;
-    }
-    
-    // Return the average (add 0.5 for rounding)
-    return (uint16_t)((ma->sum + ma->count/2) / ma->count);
+bool midi_send_note_off(int key, uint32_t capture_us, uint32_t change_us, MidiRing *ring) {
+    MidiEvent event = {
+        .type = MIDI_EVENT_NOTE_OFF,
+        .key = (uint8_t)key,
+        .velocity = 0,
+        .capture_us = capture_us,
+        .change_us = change_us,
+    };
+    return midi_send_event(&event, ring);
 }
 
-// Filter all channels at once
-void filter_all_channels(uint16_t *raw_values, uint16_t *filtered_values) {
-    for (int i = 0; i < MIDI_NO_TONES; i++) {
-        filtered_values[i] = moving_average_add(&channel_filters[i], raw_values[i]);
-    }
-}
+//--- Per-key state ---
+// Structure of arrays: every field is one array over the keys, so the passes over a frame
+// and over the keys walk contiguous memory and load only the fields they use.
+// The velocity ring has a power-of-two size and is indexed by mask.
+#define MIDI_VELOCITY_BUFFER_MASK (MIDI_VELOCITY_BUFFER_SIZE - 1)
 
-//--- State structures holding everything need for calculation NOTE ON/OFF and velocity ---
 typedef enum {
     KEY_UNDEFINED,
     KEY_RELEASED,
@@ -95,134 +53,480 @@ typedef enum {
 } KeyPosition;
 
 typedef struct {
-    uint16_t velocity_buffer[MIDI_VELOCITY_BUFFER_SIZE];
-    int index;
-    uint16_t on_threshold;
-    uint16_t off_threshold;
-    uint16_t released_voltage;
-    KeyPosition position;
-} KeyState;
-
-// Array of key states for all channels
-static KeyState key_states[MIDI_NO_TONES];
-
-// Initialize all key states
+    // Thresholds
+    uint16_t on_threshold[MIDI_NO_TONES];
+    uint16_t off_threshold[MIDI_NO_TONES];
+    uint16_t released_voltage[MIDI_NO_TONES];
+    uint16_t motion_threshold[MIDI_NO_TONES];
+    uint16_t start_threshold[MIDI_NO_TONES];    // Start of the time of flight
+
+    // Position
+    uint8_t position[MIDI_NO_TONES];            // KeyPosition
+    HallScannerKeyMask pressed;                 // Keys in KEY_PRESSED
+    HallScannerKeyMask released;                // Keys in KEY_RELEASED
+    HallScannerKeyMask changed;                 // Keys whose position changed since the last event generation
+    HallScannerKeyMask moving;                  // Keys between the rest band and ON threshold
+    uint16_t last_value[MIDI_NO_TONES];         // Value of the last processed sample
+    uint32_t last_time_us[MIDI_NO_TONES];       // Time of the last processed sample
+    uint32_t crossing_us[MIDI_NO_TONES];        // Time of the sample that last changed the position
+    uint32_t change_us[MIDI_NO_TONES];          // time_us_32() when that change was processed, latency instrumentation
+
+    // Area velocity
+    uint16_t velocity_buffer[MIDI_NO_TONES][MIDI_VELOCITY_BUFFER_SIZE];
+    uint32_t velocity_time[MIDI_NO_TONES][MIDI_VELOCITY_BUFFER_SIZE];  // time_us_32() of each velocity sample
+    uint8_t velocity_index[MIDI_NO_TONES];
+    uint8_t velocity_count[MIDI_NO_TONES];      // Valid samples in the velocity buffer
+    uint16_t history_value[MIDI_NO_TONES];      // Value assumed before the oldest buffered sample
+
+    // Time-of-flight velocity
+    bool travel_started[MIDI_NO_TONES];         // Above start threshold since an upward crossing
+    uint32_t travel_start_us[MIDI_NO_TONES];    // Interpolated upward crossing of the start threshold
+    uint32_t travel_us[MIDI_NO_TONES];          // Start threshold to ON threshold, 0 - not measured
+} KeyStates;
+
+static KeyStates keys;
+
+void midi_get_pressed_keys(HallScannerKeyMask *mask) {
+    *mask = keys.pressed;
+}
+
+// Velocity measurement of the settings
+static uint8_t velocity_mode;
+
+// Initialize all key states, the keys rested at released voltage before
 void init_all_key_states(SETTINGS *set) {
-    for (int ch = 0; ch < MIDI_NO_TONES; ch++) {
-        KeyState *ks = &key_states[ch];
-        
-        // Initialize velocity buffer with released voltage instead of zeros
-        for (int i = 0; i < MIDI_VELOCITY_BUFFER_SIZE; i++) {
-            ks->velocity_buffer[i] = set->released_voltage[ch];
-        }
-        
-        ks->index = 0;
-        ks->position = KEY_RELEASED;
-        ks->released_voltage = set->released_voltage[ch];
-        
+    keys.pressed = (HallScannerKeyMask){0};
+    keys.released = (HallScannerKeyMask){0};
+    keys.changed = (HallScannerKeyMask){0};
+    keys.moving = (HallScannerKeyMask){0};
+
+    for (int key = 0; key < MIDI_NO_TONES; key++) {
+        uint16_t released = set->released_voltage[key];
+
         // OFF threshold in between pressed and released voltage - not directly in the middle - closer to pressed voltage
-        ks->off_threshold = (3*set->pressed_voltage[ch] + 2*set->released_voltage[ch]) / 5;
+        keys.off_threshold[key] = (3*set->pressed_voltage[key] + 2*released) / 5;
         // ON threshold is OFF threshold plus hysteresis (since pressed voltage is higher)
-        uint16_t delta = set->pressed_voltage[ch] - set->released_voltage[ch]; // pressed > released
-        ks->on_threshold = ks->off_threshold + (delta * MIDI_ON_OFF_HYSTERESIS_PERCENTAGE) / 100; // add hysteresis
+        uint16_t delta = set->pressed_voltage[key] - released; // pressed > released
+        keys.on_threshold[key] = keys.off_threshold[key] + (delta * MIDI_ON_OFF_HYSTERESIS_PERCENTAGE) / 100; // add hysteresis
+        keys.released_voltage[key] = released;
+        // Key above the rest band is moving (until it reaches ON threshold)
+        keys.motion_threshold[key] = released + (delta * MIDI_MOTION_BAND_PERCENTAGE) / 100;
+        // Time of flight from the start threshold to ON threshold
+        keys.start_threshold[key] = released + (delta * MIDI_TOF_START_PERCENTAGE) / 100;
+
+        keys.position[key] = KEY_RELEASED;
+        hall_scanner_mask_set(&keys.released, key, true);
+        keys.last_value[key] = released;
+        keys.last_time_us[key] = 0;
+        keys.crossing_us[key] = 0;
+        keys.change_us[key] = 0;
+
+        // Empty velocity buffer
+        keys.velocity_index[key] = 0;
+        keys.velocity_count[key] = 0;
+        keys.history_value[key] = released;
+
+        keys.travel_started[key] = false;
+        keys.travel_start_us[key] = 0;
+        keys.travel_us[key] = 0;
+    }
+}
+
+// Time at which the line between the last and this sample reaches threshold
+static uint32_t interpolate_crossing(int key, uint16_t value, uint32_t time_us, uint16_t threshold) {
+    uint16_t last_value = keys.last_value[key];
+    uint32_t dt = time_us - keys.last_time_us[key];
+    if (dt > MIDI_TOF_MAX_INTERPOLATION_US || value == last_value) return time_us;
+    return keys.last_time_us[key] + (uint32_t)(threshold - last_value) * dt / (uint32_t)(value - last_value);
+}
+
+// Timestamps the upward crossings of the start and ON thresholds, both may fall between the same samples.
+// Called before the sample becomes the last one.
+static void update_travel(int key, uint16_t value, uint32_t time_us) {
+    uint16_t start_threshold = keys.start_threshold[key];
+    uint16_t on_threshold = keys.on_threshold[key];
+    uint16_t last_value = keys.last_value[key];
+
+    if (value <= start_threshold) {
+        // Back at rest, the next travel starts over
+        keys.travel_started[key] = false;
+        return;
+    }
+    if (last_value <= start_threshold) {
+        keys.travel_started[key] = true;
+        keys.travel_start_us[key] = interpolate_crossing(key, value, time_us, start_threshold);
+        keys.travel_us[key] = 0;
+    }
+    if (keys.travel_started[key] && value > on_threshold && last_value <= on_threshold) {
+        uint32_t end_us = interpolate_crossing(key, value, time_us, on_threshold);
+        uint32_t travel_us = end_us - keys.travel_start_us[key];
+        keys.travel_us[key] = travel_us ? travel_us : 1;
+        keys.travel_started[key] = false;
     }
 }
 
 // Update single key state - capture velocity data during key press motion
-void update_key_state(int channel, uint16_t value) {
-    KeyState *ks = &key_states[channel];
-    
-    KeyPosition old_position = ks->position;
-    
+void update_key_state(int key, uint16_t value, uint32_t time_us) {
+    uint8_t old_position = keys.position[key];
+    uint8_t position;
+
+    if (velocity_mode == MIDI_VELOCITY_MODE_TIME_OF_FLIGHT) {
+        update_travel(key, value, time_us);
+    }
+    keys.last_time_us[key] = time_us;
+    keys.last_value[key] = value;
+
     // Determine new position (pressed voltage is HIGHER than released)
-    if (value < ks->off_threshold) {
-        ks->position = KEY_RELEASED;
+    if (value < keys.off_threshold[key]) {
+        position = KEY_RELEASED;
         // Reset velocity buffer when key is released
         if (old_position != KEY_RELEASED) {
-            for (int i = 0; i < MIDI_VELOCITY_BUFFER_SIZE; i++) {
-                ks->velocity_buffer[i] = ks->off_threshold;
-            }
-            ks->index = 0;
+            keys.history_value[key] = keys.off_threshold[key];
+            keys.velocity_index[key] = 0;
+            keys.velocity_count[key] = 0;
+            // A press that does not return below the start threshold has no travel time
+            keys.travel_us[key] = 0;
         }
-    } else if (value > ks->on_threshold) {
-        ks->position = KEY_PRESSED;
+    } else if (value > keys.on_threshold[key]) {
+        position = KEY_PRESSED;
     } else {
-        ks->position = KEY_UNDEFINED;
+        position = KEY_UNDEFINED;
     }
-    
+    if (position != old_position) {
+        keys.position[key] = position;
+        hall_scanner_mask_set(&keys.pressed, key, position == KEY_PRESSED);
+        hall_scanner_mask_set(&keys.released, key, position == KEY_RELEASED);
+        hall_scanner_mask_set(&keys.changed, key, true);
+        keys.crossing_us[key] = time_us;
+        keys.change_us[key] = time_us_32();
+    }
+
     // Update velocity buffer
-    if (value > ks->released_voltage) {
-        ks->velocity_buffer[ks->index] = value;
-        ks->index = (ks->index + 1) % MIDI_VELOCITY_BUFFER_SIZE;
+    if (value > keys.released_voltage[key]) {
+        uint8_t index = keys.velocity_index[key];
+        // Overwritten sample stands for the time before the oldest kept one
+        if (keys.velocity_count[key] == MIDI_VELOCITY_BUFFER_SIZE) {
+            keys.history_value[key] = keys.velocity_buffer[key][index];
+        } else {
+            keys.velocity_count[key]++;
+        }
+        keys.velocity_buffer[key][index] = value;
+        keys.velocity_time[key][index] = time_us;
+        keys.velocity_index[key] = (index + 1) & MIDI_VELOCITY_BUFFER_MASK;
     }
-}
 
-// Function updating key state using moving average filtered values
-void update_all_key_states(void) {
-    uint16_t raw[MIDI_NO_TONES] = {0};
-    hall_scanner_read_all(raw, MIDI_NO_TONES);
-    uint16_t filtered[MIDI_NO_TONES] = {0};
-    filter_all_channels(raw, filtered);
+    // Moving keys are sampled more often by the scanner
+    hall_scanner_mask_set(&keys.moving, key, value > keys.motion_threshold[key] && value < keys.on_threshold[key]);
+}
 
-    for (int ch = 0; ch < MIDI_NO_TONES; ch++) {
-        KeyState *ks = &key_states[ch];
-        // Update the key state based on the filtered value
-        update_key_state(ch, filtered[ch]);
+// Updates the key states from the filtered conversions of one frame (key_filter_frame()),
+// in scan order - a moving key may have several conversions per frame.
+// Keys without a conversion in the frame keep their state and mask bits.
+void update_all_key_states(const HallScannerFrame *frame, const uint16_t *filtered) {
+    for (int i = 0; i < frame->count; i++) {
+        int key = frame->channel[i];
+        if (key < MIDI_NO_TONES) update_key_state(key, filtered[i], frame->time_us[i]);
     }
+
+    hall_scanner_set_active_keys(&keys.moving);
 }
 
-// Calculate velocity based on integration of area above released voltage
-uint8_t calculate_velocity(int channel) {
-    KeyState *ks = &key_states[channel];
-    
-    // Calculate the total area between on_threshold voltage and current readings
-    // Since pressing the key increases voltage, we measure area UNDER on_threshold voltage
-    uint32_t total_area = 0;
-
-    // Sum up all values under the on_threshold voltage in the buffer
-    for (int i = 0; i < MIDI_VELOCITY_BUFFER_SIZE; i++) {
-        if (ks->velocity_buffer[i] < ks->on_threshold) {
-            total_area += (ks->on_threshold - ks->velocity_buffer[i]);
+// Velocity curve of the settings, built at start
+static uint8_t velocity_lut[VELOCITY_CURVE_SIZE];
+
+// Calculate velocity based on integration of area under on_threshold voltage over time
+// Each sample holds until the next one, the integral covers MIDI_VELOCITY_WINDOW_US
+// before the last sample and is expressed in MIDI_VELOCITY_REF_PERIOD_US units,
+// so the result does not depend on the scan rate or on how often the key was sampled.
+// Integer arithmetic only (no FPU on the RP2040), returns the linear velocity before clamping.
+static uint32_t area_velocity(int key) {
+    uint16_t on_threshold = keys.on_threshold[key];
+    const uint16_t *values = keys.velocity_buffer[key];
+    const uint32_t *times = keys.velocity_time[key];
+
+    // Walk from the newest sample back, ages are relative to the last sample (wrap safe)
+    uint32_t total_area = 0;  // ADC units x us
+    uint32_t seg_end = 0;
+    int idx = keys.velocity_index[key];
+    for (int n = 0; n < keys.velocity_count[key] && seg_end < MIDI_VELOCITY_WINDOW_US; n++) {
+        idx = (idx - 1) & MIDI_VELOCITY_BUFFER_MASK;
+        uint32_t seg_start = keys.last_time_us[key] - times[idx];
+        if (seg_start > MIDI_VELOCITY_WINDOW_US) seg_start = MIDI_VELOCITY_WINDOW_US;
+        if (values[idx] < on_threshold && seg_start > seg_end) {
+            total_area += (uint32_t)(on_threshold - values[idx]) * (seg_start - seg_end);
         }
+        seg_end = seg_start;
+    }
+    // Rest of the window before the oldest buffered sample
+    if (seg_end < MIDI_VELOCITY_WINDOW_US && keys.history_value[key] < on_threshold) {
+        total_area += (uint32_t)(on_threshold - keys.history_value[key]) * (MIDI_VELOCITY_WINDOW_US - seg_end);
     }
     
     // Normalize by the actual voltage range for this specific key
     // Use on_threshold for full range (pressed voltage is higher)
-    uint16_t voltage_range = ks->on_threshold - ks->released_voltage; // pressed > released
+    uint16_t voltage_range = on_threshold - keys.released_voltage[key]; // pressed > released
     if (voltage_range == 0) return 64; // Default velocity if no range
     
-    // Normalization approach
-    float velocity = MIDI_VELOCITY_SCALING_KOEF * total_area / (float)voltage_range;
-    
+    // Normalization approach, one division (hardware divider)
+    return MIDI_VELOCITY_SCALING_KOEF * total_area / (MIDI_VELOCITY_REF_PERIOD_US * (uint32_t)voltage_range);
+}
+
+// Velocity inversely proportional to the travel time between the start and ON thresholds.
+// The thresholds are fixed fractions of the key span, so the travel time does not depend
+// on the calibration of the key, and the interpolated crossings not on the scan rate.
+static uint32_t travel_velocity(int key) {
+    return (127u * MIDI_TOF_FASTEST_US) / keys.travel_us[key];
+}
+
+// Linear velocity of the selected measurement mapped through the velocity curve.
+// Time of flight falls back to the area integral when the travel was not measured
+// (the key was already above the start threshold at start).
+uint8_t calculate_velocity(int key) {
+    uint32_t velocity;
+    if (velocity_mode == MIDI_VELOCITY_MODE_TIME_OF_FLIGHT && keys.travel_us[key]) {
+        velocity = travel_velocity(key);
+    } else {
+        velocity = area_velocity(key);
+    }
+
     // Ensure velocity is in valid MIDI range
     if (velocity > 127) velocity = 127;
     if (velocity < 1) velocity = 1;
     
-    return (uint8_t)velocity;
+    return velocity_lut[velocity];
+}
+
+//-- Output scheduler --
+// Events of one frame leave in this order: note-offs first, so the receiver frees voices
+// before new notes arrive, then note-ons loudest first. Keys of equal velocity start
+// at a key that moves on every frame, so no part of the keyboard is always last.
+// Every sounding note keeps a ring slot for its note-off: a note-on only goes out
+// when the ring has room for it and all pending note-offs, otherwise it waits for
+// a later frame while the key stays pressed. A note-off that does not fit is retried.
+typedef struct {
+    uint8_t key;
+    uint8_t velocity;
+} NoteEvent;
+
+static MidiOutputStats output_stats;
+
+void midi_get_output_stats(MidiOutputStats *stats) {
+    *stats = output_stats;
+}
+
+// Insertion sort by velocity, descending - stable, so the rotating key order stays among equals
+static void sort_note_ons(NoteEvent *events, int count) {
+    for (int i = 1; i < count; ++i) {
+        NoteEvent e = events[i];
+        int j = i;
+        for (; j > 0 && events[j - 1].velocity < e.velocity; --j) {
+            events[j] = events[j - 1];
+        }
+        events[j] = e;
+    }
+}
+
+//-- Processing cost --
+// Core1 runs SysTick from the processor clock as a free-running 24-bit down counter,
+// 134 ms at 125 MHz, far longer than a frame.
+#define SYSTICK_MASK 0x00FFFFFFu
+
+static MidiProcessStats process_stats;
+
+void midi_get_process_stats(MidiProcessStats *stats) {
+    *stats = process_stats;
+}
+
+static void cycle_counter_init(void) {
+    systick_hw->csr = 0;
+    systick_hw->rvr = SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+static inline uint32_t cycle_count(void) {
+    return systick_hw->cvr;
+}
+
+static void filter_processed(uint32_t start) {
+    uint32_t cycles = (start - cycle_count()) & SYSTICK_MASK;
+    process_stats.filter_cycles += cycles;
+    if (cycles > process_stats.max_filter_cycles) process_stats.max_filter_cycles = cycles;
+}
+
+static void frame_processed(uint32_t start) {
+    uint32_t cycles = (start - cycle_count()) & SYSTICK_MASK;
+    process_stats.frames++;
+    process_stats.cycles += cycles;
+    if (cycles > process_stats.max_cycles) process_stats.max_cycles = cycles;
+}
+
+// Filter benchmark, requests and results are numbered, core1 writes the result before its number
+static MidiFilterBenchmark filter_benchmark;
+static volatile uint32_t filter_benchmark_requested = 0;
+static volatile uint32_t filter_benchmark_done = 0;
+static uint32_t filter_benchmark_reported = 0;
+
+void midi_request_filter_benchmark(void) {
+    filter_benchmark_requested++;
+}
+
+bool midi_get_filter_benchmark(MidiFilterBenchmark *result) {
+    uint32_t done = filter_benchmark_done;
+    if (done == filter_benchmark_reported) return false;
+    __dmb();
+    *result = filter_benchmark;
+    filter_benchmark_reported = done;
+    return true;
+}
+
+// Every filter over the last frame, each from the state saved before the frame (key_filter_save())
+static void run_filter_benchmark(const HallScannerFrame *frame, uint32_t requested) {
+    static uint16_t scratch[HALL_SCANNER_FRAME_SLOTS];
+
+    for (int mode = 0; mode < KEY_FILTER_COUNT; ++mode) {
+        key_filter_trial_begin();
+        uint32_t start = cycle_count();
+        key_filter_frame_mode(mode, frame, scratch);
+        filter_benchmark.cycles[mode] = (start - cycle_count()) & SYSTICK_MASK;
+        key_filter_trial_end();
+    }
+    filter_benchmark.conversions = frame->count;
+    __dmb();
+    filter_benchmark_done = requested;
+}
+
+static bool mask_empty(const HallScannerKeyMask *mask) {
+    uint64_t any = 0;
+    for (int w = 0; w < HALL_SCANNER_MASK_WORDS; ++w) {
+        any |= mask->word[w];
+    }
+    return any == 0;
+}
+
+// Keys of the mask from first up, then from 0 below first, walked by count-trailing-zeros.
+// Returns their count.
+static int mask_keys_from(const HallScannerKeyMask *mask, int first, uint8_t *out) {
+    int count = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int w = 0; w < HALL_SCANNER_MASK_WORDS; ++w) {
+            int base = w * 64;
+            uint64_t from_first;
+            if (first <= base) {
+                from_first = ~0ull;
+            } else if (first >= base + 64) {
+                from_first = 0;
+            } else {
+                from_first = ~0ull << (first - base);
+            }
+            uint64_t bits = mask->word[w] & (pass == 0 ? from_first : ~from_first);
+            while (bits) {
+                out[count++] = (uint8_t)(base + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+    return count;
 }
 
 //-- Process MIDI messages --
-void midi_process(SETTINGS *set, critical_section_t *cs, queue_t *buff) {
+void midi_process(SETTINGS *set, MidiRing *ring) {
+    static HallScannerFrame frame;
+    static uint16_t filtered[HALL_SCANNER_FRAME_SLOTS];
     // Note ON/OFF state tracking
-    static bool note_on_sent[MIDI_NO_TONES] = {false};
+    static HallScannerKeyMask note_on_sent;
+    static uint8_t note_offs[MIDI_NO_TONES];
+    static uint8_t on_keys[MIDI_NO_TONES];
+    static NoteEvent note_ons[MIDI_NO_TONES];
+    int sounding = 0;  // Notes on whose note-off is still to be sent
+    int first_key = 0;
+    bool deferred = false;  // Events held back in the last frame, retried without a key change
+    bool benchmark = false;  // Filter state saved for the benchmark before the last frame
+    uint32_t benchmark_request = 0;
 
-    init_all_moving_averages();
     init_all_key_states(set);
+    key_filter_init(set->filter_mode, set->released_voltage);
+    velocity_curve_build(set->velocity_curve, set->velocity_user_curve, velocity_lut);
+    velocity_mode = set->velocity_mode;
+    cycle_counter_init();
 
     while (true) {
-        update_all_key_states();
-
-        for (int i = 0; i < MIDI_NO_TONES; ++i) {
-            if (key_states[i].position == KEY_PRESSED && note_on_sent[i] == false) {
-                uint8_t velocity = calculate_velocity(i);
-                printf("NOTE ON: %d, Velocity: %d\n", i, velocity);
-                midi_send_note_on(set->m_ch, set->m_base, i, velocity, cs, buff);
-                note_on_sent[i] = true;
-            } else if (key_states[i].position == KEY_RELEASED && note_on_sent[i] == true) {
-                printf("NOTE OFF: %d\n", i);
-                midi_send_note_off(set->m_ch, set->m_base, i, cs, buff);
-                note_on_sent[i] = false;
+        // Outside the frame cost, the frame processed last is filtered once per filter
+        if (benchmark) {
+            run_filter_benchmark(&frame, benchmark_request);
+            benchmark = false;
+        }
+        hall_scanner_read_frame(&frame);
+        // Filter state before the frame for the benchmark, outside the frame cost as well
+        benchmark_request = filter_benchmark_requested;
+        if (benchmark_request != filter_benchmark_done) {
+            key_filter_save();
+            benchmark = true;
+        }
+        uint32_t start = cycle_count();
+
+        key_filter_frame(&frame, filtered);
+        filter_processed(start);
+        update_all_key_states(&frame, filtered);
+
+        // Only a position change or a held back event can produce an event
+        if (!deferred && mask_empty(&keys.changed)) {
+            frame_processed(start);
+            continue;
+        }
+        keys.changed = (HallScannerKeyMask){0};
+
+        // Pressed keys not sounding yet, released keys still sounding
+        HallScannerKeyMask on_pending, off_pending;
+        for (int w = 0; w < HALL_SCANNER_MASK_WORDS; ++w) {
+            on_pending.word[w] = keys.pressed.word[w] & ~note_on_sent.word[w];
+            off_pending.word[w] = keys.released.word[w] & note_on_sent.word[w];
+        }
+        int off_count = mask_keys_from(&off_pending, first_key, note_offs);
+        int on_count = mask_keys_from(&on_pending, first_key, on_keys);
+        for (int n = 0; n < on_count; ++n) {
+            note_ons[n] = (NoteEvent){on_keys[n], calculate_velocity(on_keys[n])};
+        }
+        deferred = false;
+        if (off_count == 0 && on_count == 0) {
+            frame_processed(start);
+            continue;
+        }
+        if (++first_key == MIDI_NO_TONES) first_key = 0;
+
+        for (int n = 0; n < off_count; ++n) {
+            int i = note_offs[n];
+            if (!midi_send_note_off(i, keys.crossing_us[i], keys.change_us[i], ring)) {
+                output_stats.deferred_note_offs++;
+                deferred = true;
+                continue;
             }
+            TRACE_INFO(TRACE_NOTE_OFF, i, 0);
+            hall_scanner_mask_set(&note_on_sent, i, false);
+            sounding--;
+        }
+
+        sort_note_ons(note_ons, on_count);
+        for (int n = 0; n < on_count; ++n) {
+            int i = note_ons[n].key;
+            // Room for this note-on and the note-offs of all sounding notes
+            if (midi_ring_count(ring) + sounding + 1 >= MIDI_RING_SIZE
+                || !midi_send_note_on(i, note_ons[n].velocity, keys.crossing_us[i],
+                                      keys.change_us[i], ring)) {
+                output_stats.deferred_note_ons++;
+                deferred = true;
+                continue;
+            }
+            TRACE_INFO(TRACE_NOTE_ON, i, note_ons[n].velocity);
+            hall_scanner_mask_set(&note_on_sent, i, true);
+            sounding++;
+        }
+
+        output_stats.frames++;
+        output_stats.backlog = midi_ring_count(ring);
+        if (output_stats.backlog > output_stats.max_backlog) {
+            output_stats.max_backlog = output_stats.backlog;
         }
+        frame_processed(start);
     }
 }
\ No newline at end of file
@@ -1,28 +1,101 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
-#include "pico/util/queue.h"
-#include "pico/critical_section.h"
 #include "hall_scanner.h"
+#include "midi_ring.h"
 #include "settings.h"
 #include "midi_defs.h"
+#include "key_filter.h"
 
-// filtering of analog values using moving average
-#define MIDI_MA_COUNT 2  // Moving average window size
+#if MIDI_NO_TONES > HALL_SCANNER_NUM_CHANNELS
+#error "MIDI_NO_TONES exceeds the channels of the configured ADC chips"
+#endif
 
-// Buffer for velocity calculation
-#define MIDI_VELOCITY_BUFFER_SIZE 15
+#if MIDI_RING_SIZE <= MIDI_NO_TONES
+#error "MIDI_RING_SIZE has to hold the note-offs of all keys"
+#endif
+
+// Buffer for velocity calculation, has to be a power of two
+// Sized for moving keys sampled several times per frame in activity scan
+#define MIDI_VELOCITY_BUFFER_SIZE 64
+
+#if MIDI_VELOCITY_BUFFER_SIZE & (MIDI_VELOCITY_BUFFER_SIZE - 1) || MIDI_VELOCITY_BUFFER_SIZE > 128
+#error "MIDI_VELOCITY_BUFFER_SIZE has to be a power of two up to 128"
+#endif
+
+// Velocity integration window and time unit of the integral (15 samples at 1 kHz scan rate)
+#define MIDI_VELOCITY_WINDOW_US 15000
+#define MIDI_VELOCITY_REF_PERIOD_US 1000
 
 // Velocity to MIDI scaling factor
 #define MIDI_VELOCITY_SCALING_KOEF 11
 
+// The velocity integral is computed in 32-bit integers (ADC units x us)
+#if MIDI_VELOCITY_SCALING_KOEF * MIDI_VELOCITY_WINDOW_US * (HALL_SCANNER_MAX_VALUE + 1ll) > 0xFFFFFFFFll
+#error "Velocity integral overflows 32 bits, shorten MIDI_VELOCITY_WINDOW_US"
+#endif
+
+// Time-of-flight velocity: the travel starts at the start threshold (in percentage of the total
+// span of analog values above released voltage) and ends at ON threshold.
+// Travel of MIDI_TOF_FASTEST_US or less gives velocity 127, velocity is inversely proportional to the travel time.
+#define MIDI_TOF_START_PERCENTAGE 20
+#define MIDI_TOF_FASTEST_US 1500
+
+// Samples further apart are not interpolated, the crossing takes the time of the later one
+#define MIDI_TOF_MAX_INTERPOLATION_US 65535
+
 // NOTE ON / NOTE OFF hysteresis (in percentage of the total span of analog values)
 #define MIDI_ON_OFF_HYSTERESIS_PERCENTAGE 20
 
-// MIDI API
-bool midi_send_msg(uint8_t *data, int no_bytes, critical_section_t *cs, queue_t *buff);
-bool midi_send_note_on(uint8_t channel, uint8_t midi_base, int input, uint8_t velocity, critical_section_t *cs, queue_t *buff);
-bool midi_send_note_off(uint8_t channel, uint8_t midi_base, int input, critical_section_t *cs, queue_t *buff);
+// Rest band above released voltage (in percentage of the total span of analog values)
+// Key between the rest band and ON threshold is in motion
+#define MIDI_MOTION_BAND_PERCENTAGE 10
+
+// Output scheduler statistics, written by core1
+typedef struct {
+    uint32_t frames;              // Frames with at least one note event
+    uint32_t backlog;             // Messages waiting in the ring after the last such frame
+    uint32_t max_backlog;         // Largest backlog since boot
+    uint32_t deferred_note_offs;  // Note-offs retried in a later frame because the ring was full
+    uint32_t deferred_note_ons;   // Note-ons held back to keep ring space for note-offs
+} MidiOutputStats;
+
+void midi_get_output_stats(MidiOutputStats *stats);
+
+// Core1 processing cost, processor cycles from the frame hand-over to the last event of the frame
+// and of the filter stage (key_filter.h) alone
+typedef struct {
+    uint32_t frames;             // Frames processed
+    uint32_t cycles;             // Cycles of all frames, wraps - use differences
+    uint32_t max_cycles;         // Most expensive frame since boot
+    uint32_t filter_cycles;      // Filter cycles of all frames, wraps - use differences
+    uint32_t max_filter_cycles;  // Most expensive filter pass since boot
+} MidiProcessStats;
+
+void midi_get_process_stats(MidiProcessStats *stats);
+
+// One-shot timing of every filter (key_filter.h) over the same frame, run by core1 on request.
+// Every filter starts from the filter state before the frame and sees its conversion times,
+// like on a real frame. The selected filter keeps its state.
+typedef struct {
+    uint32_t conversions;               // Conversions of the frame
+    uint32_t cycles[KEY_FILTER_COUNT];  // Filter pass cycles per filter mode
+} MidiFilterBenchmark;
+
+// Core0 side, the result is ready after the next frame
+void midi_request_filter_benchmark(void);
+// Returns true once per request when the result is ready
+bool midi_get_filter_benchmark(MidiFilterBenchmark *result);
+
+// Snapshot of the keys held down (past ON threshold), written by core1 once per conversion,
+// readable from core0 - a key may be one frame stale
+void midi_get_pressed_keys(HallScannerKeyMask *mask);
+
+// MIDI API, note events are pushed into the ring drained by core0
+bool midi_send_event(MidiEvent *event, MidiRing *ring);
+bool midi_send_note_on(int key, uint8_t velocity, uint32_t capture_us, uint32_t change_us, MidiRing *ring);
+bool midi_send_note_off(int key, uint32_t capture_us, uint32_t change_us, MidiRing *ring);
+
 
 // Process MIDI messages based on sensor inputs
-void midi_process(SETTINGS *set, critical_section_t *cs, queue_t *buff);
+void midi_process(SETTINGS *set, MidiRing *ring);
@@ -1,7 +1,14 @@
 #pragma once
 
-// MIDI message buffer size
-#define MIDI_BUFFER_SIZE 256
-
 // real number of tone for the keyboard
+// More than 64 tones need the second SPI bus (HALL_SCANNER_NUM_BUSES)
+#ifndef MIDI_NO_TONES
 #define MIDI_NO_TONES 61
+#endif
+
+// Velocity measurement
+// AREA           - integral of the key position over the last samples
+// TIME_OF_FLIGHT - travel time between two thresholds, like dual-contact keybeds
+#define MIDI_VELOCITY_MODE_AREA 0
+#define MIDI_VELOCITY_MODE_TIME_OF_FLIGHT 1
+#define MIDI_VELOCITY_MODE_COUNT 2
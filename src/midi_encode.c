@@ -0,0 +1,49 @@
+#include "midi_encode.h"
+
+#define MIDI_STATUS_NOTE_OFF 0x80
+#define MIDI_STATUS_NOTE_ON 0x90
+
+int midi_event_serialize(const MidiEvent *event, uint8_t channel, uint8_t midi_base, uint8_t *data) {
+    int note = midi_base + event->key;
+    if (note > 127) return 0;
+    data[0] = ((event->type == MIDI_EVENT_NOTE_ON) ? MIDI_STATUS_NOTE_ON : MIDI_STATUS_NOTE_OFF) | (channel & 0x0F);
+    data[1] = (uint8_t)note;
+    data[2] = event->velocity;
+    return 3;
+}
+
+uint8_t midi_running_status_encode(MidiRunningStatus *rs, const uint8_t *data, uint8_t length,
+                                   uint32_t now_us, uint8_t *out) {
+    if (length == 0) return 0;
+    uint8_t status = data[0];
+    uint8_t count = 0;
+
+#if MIDI_NOTE_OFF_AS_ZERO_VELOCITY
+    bool note_off = (status & 0xF0) == MIDI_STATUS_NOTE_OFF && length == 3;
+    if (note_off) status = MIDI_STATUS_NOTE_ON | (status & 0x0F);
+#endif
+
+    bool send_status = true;
+#if MIDI_RUNNING_STATUS_ENABLED
+    if (status < 0xF0 && status == rs->status && now_us - rs->time_us < MIDI_RUNNING_STATUS_REFRESH_US) {
+        send_status = false;
+    }
+#endif
+    if (send_status) out[count++] = status;
+    for (uint8_t i = 1; i < length; ++i) {
+        out[count++] = data[i];
+    }
+#if MIDI_NOTE_OFF_AS_ZERO_VELOCITY
+    if (note_off) out[count - 1] = 0;
+#endif
+
+    // Channel messages set the running status, system common messages cancel it,
+    // real-time messages leave it alone
+    if (status < 0xF0) {
+        if (send_status) rs->time_us = now_us;
+        rs->status = status;
+    } else if (status < 0xF8) {
+        rs->status = 0;
+    }
+    return count;
+}
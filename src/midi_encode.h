@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_ring.h"
+
+// MIDI wire encoding shared by the transports. No hardware access, so it builds on a host
+// as well (test/midi_encode_check.c).
+
+/**
+ * @brief Enable running status optimization (MIDI 1.0 feature)
+ * Allows channel messages to omit repeated status bytes.
+ * Used by the DIN MIDI output encoder (midi_uart.c) as well.
+ * Disable if strict message framing is required.
+ */
+#define MIDI_RUNNING_STATUS_ENABLED 1
+
+/**
+ * @brief Send Note Off as Note On with velocity 0 on the DIN MIDI output
+ * Presses and releases then share one running status byte.
+ */
+#define MIDI_NOTE_OFF_AS_ZERO_VELOCITY 1
+
+// Running status repeats the status byte at least this often,
+// so a receiver plugged in meanwhile picks up the stream
+#define MIDI_RUNNING_STATUS_REFRESH_US 250000
+
+// Status byte of the last channel message sent, status 0 - none
+typedef struct {
+    uint8_t status;
+    uint32_t time_us;  // Last time the status byte was sent in full
+} MidiRunningStatus;
+
+// MIDI bytes of an event, returns their count, 0 for a note above 127 (not sent)
+int midi_event_serialize(const MidiEvent *event, uint8_t channel, uint8_t midi_base, uint8_t *data);
+
+// Wire bytes of one complete message sent at now_us, returns their count (at most length).
+// Updates the running status, keep a copy to undo it when the bytes cannot be sent.
+uint8_t midi_running_status_encode(MidiRunningStatus *rs, const uint8_t *data, uint8_t length,
+                                   uint32_t now_us, uint8_t *out);
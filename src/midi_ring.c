@@ -0,0 +1,35 @@
+#include "midi_ring.h"
+#include "hardware/sync.h"
+
+void midi_ring_init(MidiRing *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+}
+
+bool midi_ring_push(MidiRing *ring, const MidiEvent *event) {
+    uint32_t head = ring->head;
+    if (head - ring->tail == MIDI_RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+    ring->slot[head & MIDI_RING_MASK] = *event;
+    // Slot contents are visible before the consumer sees the new head
+    __dmb();
+    ring->head = head + 1;
+    // Wake the consumer core waiting in __wfe()
+    __sev();
+    return true;
+}
+
+bool midi_ring_pop(MidiRing *ring, MidiEvent *event) {
+    uint32_t tail = ring->tail;
+    if (tail == ring->head) return false;
+    // Slot is read after the head that published it
+    __dmb();
+    *event = ring->slot[tail & MIDI_RING_MASK];
+    // Slot is read before the producer may reuse it
+    __dmb();
+    ring->tail = tail + 1;
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Events in the ring, has to be a power of two.
+// Larger than MIDI_NO_TONES, the output scheduler keeps a slot for the note-off of every key.
+#define MIDI_RING_SIZE 128
+#define MIDI_RING_MASK (MIDI_RING_SIZE - 1)
+
+// Longest serialized event (channel voice messages)
+#define MIDI_MESSAGE_MAX_BYTES 3
+
+typedef enum {
+    MIDI_EVENT_NOTE_OFF = 0,
+    MIDI_EVENT_NOTE_ON = 1,
+} MidiEventType;
+
+// Note event produced by midi_process(), serialized by core0 for the active transports
+typedef struct {
+    uint8_t type;        // MidiEventType
+    uint8_t key;         // Key index, the MIDI note is m_base + key
+    uint8_t velocity;    // 1-127 for note-on, 0 for note-off
+    uint32_t capture_us; // time_us_32() of the conversion that crossed the threshold
+    uint32_t change_us;  // time_us_32() when core1 saw the key state change
+    uint32_t post_us;    // time_us_32() when the event was pushed into the ring
+    uint32_t seq;        // Event number, consecutive per producer
+} MidiEvent;
+
+// Single-producer/single-consumer ring of MIDI events between the cores.
+// Only the producer writes head and only the consumer writes tail, the memory
+// barriers order the slot accesses against them, so neither side ever waits for the other.
+// Indexes run freely and wrap at 2^32, head - tail is the number of queued messages.
+typedef struct {
+    MidiEvent slot[MIDI_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;  // Events lost because the ring was full, written by the producer
+} MidiRing;
+
+void midi_ring_init(MidiRing *ring);
+
+// Producer side, returns false when the ring is full.
+// Every push signals an event, so the consumer can sleep in __wfe() while the ring is empty.
+bool midi_ring_push(MidiRing *ring, const MidiEvent *event);
+
+// Consumer side, returns false when the ring is empty
+bool midi_ring_pop(MidiRing *ring, MidiEvent *event);
+
+// Events waiting for the consumer, exact on the producer side, an upper bound elsewhere
+static inline uint32_t midi_ring_count(const MidiRing *ring) {
+    return ring->head - ring->tail;
+}
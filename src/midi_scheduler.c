@@ -0,0 +1,116 @@
+#include "midi_scheduler.h"
+#include "pico/time.h"
+#include "hardware/sync.h"
+
+static uint32_t delay_us = 0;
+
+// Pending events sorted by due time
+static MidiEvent pending[MIDI_SCHEDULER_SIZE];
+static uint32_t pending_due[MIDI_SCHEDULER_SIZE];
+static bool pending_late[MIDI_SCHEDULER_SIZE];  // Already due when it arrived
+static int pending_count = 0;
+
+// Alarm waking core0 from __wfe() at the earliest due time
+static alarm_id_t wake_alarm = 0;
+static uint32_t wake_due;
+
+static MidiSchedulerStats stats;
+static bool overflow = false;  // Counted already, until a slot frees
+
+// Wrap safe comparison of time_us_32() stamps
+static inline bool time_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// The interrupt itself wakes the core, nothing to do here
+static int64_t wake_alarm_callback(alarm_id_t id, void *user_data) {
+    wake_alarm = 0;
+    return 0;
+}
+
+static void arm_wake_alarm(void) {
+    if (pending_count == 0) return;
+    uint32_t due = pending_due[0];
+    if (wake_alarm && due == wake_due) return;
+
+    if (wake_alarm) cancel_alarm(wake_alarm);
+    int32_t in_us = (int32_t)(due - time_us_32());
+    if (in_us < 1) in_us = 1;
+    wake_due = due;
+    wake_alarm = add_alarm_in_us(in_us, wake_alarm_callback, NULL, true);
+}
+
+void midi_scheduler_init(uint32_t delay) {
+    delay_us = delay;
+    stats.delay_us = delay;
+}
+
+bool midi_scheduler_enabled(void) {
+    return delay_us != 0;
+}
+
+bool midi_scheduler_full(void) {
+    if (pending_count < MIDI_SCHEDULER_SIZE) return false;
+    if (!overflow) {
+        stats.overflows++;
+        overflow = true;
+    }
+    return true;
+}
+
+bool midi_scheduler_add(const MidiEvent *event) {
+    if (pending_count == MIDI_SCHEDULER_SIZE) return false;
+    uint32_t due = event->capture_us + delay_us;
+    bool late = !time_before(time_us_32(), due);
+    if (late) stats.late++;
+
+    // Insertion keeps events with the same due time in arrival order
+    int i = pending_count;
+    for (; i > 0 && time_before(due, pending_due[i - 1]); --i) {
+        pending[i] = pending[i - 1];
+        pending_due[i] = pending_due[i - 1];
+        pending_late[i] = pending_late[i - 1];
+    }
+    pending[i] = *event;
+    pending_due[i] = due;
+    pending_late[i] = late;
+    pending_count++;
+
+    arm_wake_alarm();
+    return true;
+}
+
+bool midi_scheduler_pop_due(MidiEvent *event) {
+    if (pending_count == 0) return false;
+    uint32_t now = time_us_32();
+    if (time_before(now, pending_due[0])) {
+        arm_wake_alarm();
+        return false;
+    }
+
+    // The error of a late event is the processing delay, not the scheduler's
+    if (!pending_late[0]) {
+        uint32_t error_us = now - pending_due[0];
+        stats.events++;
+        stats.total_error_us += error_us;
+        if (error_us > stats.max_error_us) stats.max_error_us = error_us;
+    }
+
+    *event = pending[0];
+    pending_count--;
+    overflow = false;
+    for (int i = 0; i < pending_count; ++i) {
+        pending[i] = pending[i + 1];
+        pending_due[i] = pending_due[i + 1];
+        pending_late[i] = pending_late[i + 1];
+    }
+    arm_wake_alarm();
+    return true;
+}
+
+void midi_scheduler_get_stats(MidiSchedulerStats *out) {
+    *out = stats;
+    stats.events = 0;
+    stats.total_error_us = 0;
+    stats.max_error_us = 0;
+}
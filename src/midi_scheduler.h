@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_ring.h"
+
+// Fixed-latency output: every event is sent at its capture time plus a constant delay,
+// so the scan position of the key and the wake-up time of core0 do not show in the timing.
+// Runs on core0, between the ring and the transports.
+
+// Events waiting for their send time
+#define MIDI_SCHEDULER_SIZE MIDI_RING_SIZE
+
+// Send error = send time - (capture time + delay), the achieved jitter
+typedef struct {
+    uint32_t delay_us;
+    uint32_t events;          // Events sent on time by the scheduler
+    uint64_t total_error_us;
+    uint32_t max_error_us;
+    uint32_t late;            // Events already due when they arrived, sent at once (since boot)
+    uint32_t overflows;       // Times the queue was full with events waiting in the ring (since boot)
+} MidiSchedulerStats;
+
+// delay_us 0 disables the scheduler
+void midi_scheduler_init(uint32_t delay_us);
+bool midi_scheduler_enabled(void);
+
+// Call with events waiting only, counts an overflow each time the queue fills up.
+// The caller leaves the events in the ring then, so none overtakes the queued ones.
+bool midi_scheduler_full(void);
+
+// Queues an event for capture_us + delay_us, returns false when the queue is full
+bool midi_scheduler_add(const MidiEvent *event);
+
+// Returns the next event that is due and arms the wake-up alarm for the one after it
+bool midi_scheduler_pop_due(MidiEvent *event);
+
+// Returns the statistics and clears the error statistics
+void midi_scheduler_get_stats(MidiSchedulerStats *stats);
@@ -0,0 +1,135 @@
+#include "midi_uart.h"
+#include "midi_encode.h"
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/gpio.h"
+#include "pico/stdlib.h"
+
+// Output ring of bytes. The DMA reads it with address wrapping, so a transfer may run
+// across the end of the buffer. head is written by midi_uart_send() only, tail and the
+// DMA start by midi_uart_kick() with interrupts disabled on this core.
+static uint8_t tx_ring[MIDI_UART_RING_SIZE] __attribute__((aligned(MIDI_UART_RING_SIZE)));
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;       // First byte of the running transfer
+static volatile uint32_t tail_end = 0;   // Byte after the running transfer
+
+static int tx_chan;
+static uint32_t uart_baud;
+static bool loopback_ok = false;
+static volatile uint32_t queued_bytes = 0;
+static volatile uint32_t dropped_bytes = 0;
+
+// Running status of the DIN output (midi_encode.h)
+static MidiRunningStatus running_status;
+
+// Starts a transfer of everything queued when the DMA is idle.
+// Called from the DMA IRQ and from midi_uart_send() with interrupts disabled.
+static void midi_uart_kick(void) {
+    if (dma_channel_is_busy(tx_chan)) return;
+    tail = tail_end;
+    uint32_t count = head - tail;
+    if (count == 0) return;
+    tail_end = head;
+    dma_channel_set_read_addr(tx_chan, &tx_ring[tail & (MIDI_UART_RING_SIZE - 1)], false);
+    dma_channel_set_trans_count(tx_chan, count, true);
+}
+
+static void __isr midi_uart_dma_handler(void) {
+    dma_channel_acknowledge_irq0(tx_chan);
+    midi_uart_kick();
+}
+
+bool midi_uart_send(const uint8_t *data, uint8_t length) {
+    if (length == 0 || length > MIDI_MESSAGE_MAX_BYTES) return false;
+    uint8_t wire[MIDI_MESSAGE_MAX_BYTES];
+    MidiRunningStatus rs = running_status;
+    uint8_t count = midi_running_status_encode(&rs, data, length, time_us_32(), wire);
+
+    uint32_t h = head;
+    // The running transfer still owns its bytes, a dropped message leaves the running status
+    if (MIDI_UART_RING_SIZE - (h - tail) < count) {
+        dropped_bytes += count;
+        return false;
+    }
+    for (uint8_t i = 0; i < count; ++i) {
+        tx_ring[h++ & (MIDI_UART_RING_SIZE - 1)] = wire[i];
+    }
+    queued_bytes += count;
+    head = h;
+    running_status = rs;
+
+    uint32_t ints = save_and_disable_interrupts();
+    midi_uart_kick();
+    restore_interrupts(ints);
+    return true;
+}
+
+// Sends a message through the DMA path with the UART looped back internally and checks
+// that the same bytes arrive without framing, parity or break errors.
+// The TX pin is not connected yet, so nothing reaches the MIDI cable.
+static bool midi_uart_loopback_test(void) {
+    // Note On with velocity 0, the encoder sends it unchanged with a full status byte
+    static const uint8_t test_msg[3] = {0x90, 0x3C, 0x00};
+    uart_hw_t *hw = uart_get_hw(MIDI_UART);
+    bool ok = true;
+
+    hw_set_bits(&hw->cr, UART_UARTCR_LBE_BITS);
+    midi_uart_send(test_msg, sizeof(test_msg));
+    for (unsigned i = 0; i < sizeof(test_msg); ++i) {
+        // 10 bit times per byte, twice the time of the whole message is plenty
+        if (!uart_is_readable_within_us(MIDI_UART, 2 * 10 * 1000000u * sizeof(test_msg) / uart_baud + 100)) {
+            ok = false;
+            break;
+        }
+        uint32_t dr = hw->dr;
+        if ((dr & (UART_UARTDR_FE_BITS | UART_UARTDR_PE_BITS | UART_UARTDR_BE_BITS | UART_UARTDR_OE_BITS))
+            || (uint8_t)dr != test_msg[i]) {
+            ok = false;
+        }
+    }
+    uart_tx_wait_blocking(MIDI_UART);
+    hw_clear_bits(&hw->cr, UART_UARTCR_LBE_BITS);
+    while (uart_is_readable(MIDI_UART)) {
+        (void)hw->dr;
+    }
+    // The test bytes do not count as sent MIDI and the receiver never saw their status
+    queued_bytes = 0;
+    running_status = (MidiRunningStatus){0};
+    return ok;
+}
+
+void midi_uart_init(bool fast) {
+    uart_baud = uart_init(MIDI_UART, fast ? MIDI_UART_FAST_BAUD : MIDI_UART_BAUD);
+    // MIDI frame: 1 start bit, 8 data bits, 1 stop bit
+    uart_set_format(MIDI_UART, 8, 1, UART_PARITY_NONE);
+    uart_set_fifo_enabled(MIDI_UART, true);
+
+    // TX channel reads the ring with wrapping and feeds the UART FIFO
+    tx_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, MIDI_UART_RING_BITS);
+    channel_config_set_dreq(&c, uart_get_dreq(MIDI_UART, true));
+    dma_channel_configure(tx_chan, &c, &uart_get_hw(MIDI_UART)->dr, tx_ring, 0, false);
+
+    dma_channel_set_irq0_enabled(tx_chan, true);
+    irq_set_exclusive_handler(MIDI_UART_DMA_IRQ, midi_uart_dma_handler);
+    irq_set_enabled(MIDI_UART_DMA_IRQ, true);
+
+    // Reported by the scan setup report, USB stdio is not up yet
+    loopback_ok = midi_uart_loopback_test();
+
+    gpio_set_function(MIDI_UART_TX_PIN, GPIO_FUNC_UART);
+}
+
+void midi_uart_get_stats(MidiUartStats *stats) {
+    stats->baud = uart_baud;
+    stats->bytes = queued_bytes;
+    stats->dropped = dropped_bytes;
+    stats->loopback_ok = loopback_ok;
+    stats->backlog = (head - tail_end) + dma_channel_hw_addr(tx_chan)->transfer_count;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// DIN MIDI output - UART0 TX on GP0
+#define MIDI_UART uart0
+#define MIDI_UART_TX_PIN 0
+
+// Standard MIDI baud rate and the fast_midi rate for serial-to-host bridges
+#define MIDI_UART_BAUD 31250
+#define MIDI_UART_FAST_BAUD 1000000
+
+// Bytes waiting for the DMA, has to be a power of two (DMA read ring)
+#define MIDI_UART_RING_BITS 8
+#define MIDI_UART_RING_SIZE (1 << MIDI_UART_RING_BITS)
+
+// The UART TX DMA raises this IRQ, DMA_IRQ_1 belongs to the hall scanner
+#define MIDI_UART_DMA_IRQ DMA_IRQ_0
+
+typedef struct {
+    uint32_t baud;
+    uint32_t bytes;    // Bytes queued for transmission
+    uint32_t dropped;  // Bytes lost because the output ring was full
+    uint32_t backlog;  // Bytes not handed over to the UART FIFO yet
+    bool loopback_ok;  // Result of the self-test in midi_uart_init()
+} MidiUartStats;
+
+// Sets up the UART and its TX DMA, fast selects MIDI_UART_FAST_BAUD.
+// Runs the loopback self-test before the TX pin is connected.
+void midi_uart_init(bool fast);
+
+// Queues one message of up to MIDI_MESSAGE_MAX_BYTES for transmission and returns at once.
+// Must be called from the core that called midi_uart_init().
+bool midi_uart_send(const uint8_t *data, uint8_t length);
+
+void midi_uart_get_stats(MidiUartStats *stats);
@@ -1,7 +1,9 @@
 #include "settings.h"
 
 uint8_t *flash_target_contents = (uint8_t *) (XIP_BASE + SETTINGS_FLASH_TARGET_OFFSET);
-uint8_t flash_buff[FLASH_PAGE_SIZE];
+// Settings are programmed in whole flash pages
+#define SETTINGS_FLASH_SIZE (((sizeof(SETTINGS) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE) * FLASH_PAGE_SIZE)
+uint8_t flash_buff[SETTINGS_FLASH_SIZE];
 
 void settings_save(SETTINGS *set) {
     uint32_t ints = save_and_disable_interrupts();
@@ -10,10 +12,30 @@ void settings_save(SETTINGS *set) {
 
     // write new settings
     memcpy(flash_buff, set, sizeof(SETTINGS));
-    flash_range_program(SETTINGS_FLASH_TARGET_OFFSET, (uint8_t *)flash_buff, FLASH_PAGE_SIZE);
+    flash_range_program(SETTINGS_FLASH_TARGET_OFFSET, (uint8_t *)flash_buff, SETTINGS_FLASH_SIZE);
     restore_interrupts (ints);
 }
 
+// Key N on ADC input N
+void settings_key_map_default(uint8_t *key_map) {
+    for (int i = 0; i < MIDI_NO_TONES; ++i) {
+        key_map[i] = i;
+    }
+}
+
+// Every key has an existing input or none, no input is shared and at least one key is mapped
+bool settings_key_map_valid(const uint8_t *key_map) {
+    bool used[HALL_SCANNER_NUM_CHANNELS] = {false};
+    bool mapped = false;
+    for (int i = 0; i < MIDI_NO_TONES; ++i) {
+        if (key_map[i] == SETTINGS_KEY_MAP_UNMAPPED) continue;
+        if (key_map[i] >= HALL_SCANNER_NUM_CHANNELS || used[key_map[i]]) return false;
+        used[key_map[i]] = true;
+        mapped = true;
+    }
+    return mapped;
+}
+
 void settings_load(SETTINGS *set) {
     memcpy(set, flash_target_contents, sizeof(SETTINGS));
 
@@ -33,6 +55,43 @@ void settings_load(SETTINGS *set) {
                 set->released_voltage[i] = SETTINGS_RELEASED_VOLTAGE_DEF;
                 set->pressed_voltage[i] = SETTINGS_PRESSED_VOLTAGE_DEF;
             }
+            set->scan_rate = SETTINGS_SCAN_RATE_DEF;
+            set->spi_clock = SETTINGS_SPI_CLOCK_DEF;
+            settings_key_map_default(set->key_map);
+            set->output_delay = SETTINGS_OUTPUT_DELAY_DEF;
+            set->velocity_curve = SETTINGS_VELOCITY_CURVE_DEF;
+            velocity_curve_user_default(set->velocity_user_curve);
+            set->velocity_mode = SETTINGS_VELOCITY_MODE_DEF;
+            set->filter_mode = SETTINGS_FILTER_MODE_DEF;
             settings_save(set);
     }
+
+    // Fields added after the first release are not covered by magic numbers
+    if (set->m_base > SETTINGS_M_BASE_MAX) {
+        set->m_base = SETTINGS_M_BASE_DEF;
+    }
+    if (set->scan_rate < SETTINGS_SCAN_RATE_MIN || set->scan_rate > SETTINGS_SCAN_RATE_MAX) {
+        set->scan_rate = SETTINGS_SCAN_RATE_DEF;
+    }
+    if (set->spi_clock < SETTINGS_SPI_CLOCK_MIN || set->spi_clock > SETTINGS_SPI_CLOCK_MAX) {
+        set->spi_clock = SETTINGS_SPI_CLOCK_DEF;
+    }
+    if (!settings_key_map_valid(set->key_map)) {
+        settings_key_map_default(set->key_map);
+    }
+    if (set->output_delay > SETTINGS_OUTPUT_DELAY_MAX) {
+        set->output_delay = SETTINGS_OUTPUT_DELAY_DEF;
+    }
+    if (set->velocity_curve >= VELOCITY_CURVE_COUNT) {
+        set->velocity_curve = SETTINGS_VELOCITY_CURVE_DEF;
+    }
+    if (!velocity_curve_user_valid(set->velocity_user_curve)) {
+        velocity_curve_user_default(set->velocity_user_curve);
+    }
+    if (set->velocity_mode >= MIDI_VELOCITY_MODE_COUNT) {
+        set->velocity_mode = SETTINGS_VELOCITY_MODE_DEF;
+    }
+    if (set->filter_mode >= KEY_FILTER_COUNT) {
+        set->filter_mode = SETTINGS_FILTER_MODE_DEF;
+    }
 }
\ No newline at end of file
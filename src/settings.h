@@ -10,6 +10,9 @@
 #include "hardware/flash.h"
 
 #include "midi_defs.h"
+#include "hall_scanner.h"
+#include "velocity_curve.h"
+#include "key_filter.h"
 
 
 // Last sector of Flash
@@ -33,6 +36,28 @@ typedef struct SETTINGS_ {
     // Voltage of the released key
     uint16_t released_voltage[MIDI_NO_TONES];
 
+    // Scan frame rate in Hz
+    uint16_t scan_rate;
+
+    // Maximal SPI clock in kHz, the boot self-test may choose a lower one
+    uint16_t spi_clock;
+
+    // ADC input of each key (chip x channels per chip + channel), see hall_scanner.h
+    uint8_t key_map[MIDI_NO_TONES];
+
+    // Fixed MIDI output latency in us after the capture of the event, 0 - send at once
+    uint16_t output_delay;
+
+    // Velocity curve (VELOCITY_CURVE_xxx) and the points of the user curve, see velocity_curve.h
+    uint8_t velocity_curve;
+    uint8_t velocity_user_curve[VELOCITY_CURVE_USER_POINTS];
+
+    // Velocity measurement (MIDI_VELOCITY_MODE_xxx)
+    uint8_t velocity_mode;
+
+    // Filter of the conversions (KEY_FILTER_xxx), see key_filter.h
+    uint8_t filter_mode;
+
 } SETTINGS;
 
 // default values
@@ -43,8 +68,24 @@ typedef struct SETTINGS_ {
 #define SETTINGS_FAST_MIDI_DEF 0
 #define SETTINGS_M_CH_DEF 0
 #define SETTINGS_M_BASE_DEF 36
-#define SETTINGS_RELEASED_VOLTAGE_DEF 500
-#define SETTINGS_PRESSED_VOLTAGE_DEF 700
+// The top key has to stay within the MIDI notes 0-127
+#define SETTINGS_M_BASE_MAX (127 - (MIDI_NO_TONES - 1))
+#define SETTINGS_RELEASED_VOLTAGE_DEF HALL_SCANNER_SCALE_10BIT(500)
+#define SETTINGS_PRESSED_VOLTAGE_DEF HALL_SCANNER_SCALE_10BIT(700)
+#define SETTINGS_SCAN_RATE_DEF 1000
+#define SETTINGS_SCAN_RATE_MIN 100
+#define SETTINGS_SCAN_RATE_MAX 8000
+#define SETTINGS_SPI_CLOCK_DEF 3600
+#define SETTINGS_SPI_CLOCK_MIN 500
+#define SETTINGS_SPI_CLOCK_MAX 20000
+#define SETTINGS_KEY_MAP_UNMAPPED HALL_SCANNER_UNMAPPED
+#define SETTINGS_OUTPUT_DELAY_DEF 0
+#define SETTINGS_OUTPUT_DELAY_MAX 10000
+#define SETTINGS_VELOCITY_CURVE_DEF VELOCITY_CURVE_LINEAR
+#define SETTINGS_VELOCITY_MODE_DEF MIDI_VELOCITY_MODE_AREA
+#define SETTINGS_FILTER_MODE_DEF KEY_FILTER_MOVING_AVERAGE
 
 extern void settings_load(SETTINGS *set);
-extern void settings_save(SETTINGS *set);
\ No newline at end of file
+extern void settings_save(SETTINGS *set);
+extern void settings_key_map_default(uint8_t *key_map);
+extern bool settings_key_map_valid(const uint8_t *key_map);
\ No newline at end of file
@@ -30,12 +30,8 @@
  */
 #define MIDI_MAX_MESSAGE_SIZE 3
 
-/**
- * @brief Enable running status optimization (MIDI 1.0 feature)
- * Allows channel messages to omit repeated status bytes.
- * Disable if strict message framing is required.
- */
-#define MIDI_RUNNING_STATUS_ENABLED 1
+// MIDI_RUNNING_STATUS_ENABLED and MIDI_NOTE_OFF_AS_ZERO_VELOCITY
+#include "midi_encode.h"
 
 /**
  * @brief MIDI Message Type Constants
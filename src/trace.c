@@ -0,0 +1,47 @@
+#include "trace.h"
+#include "tusb.h"
+#include <stdio.h>
+
+TraceRing trace_rings[2];
+
+// Formats take arg0 and arg1, in this order
+static const char *const trace_formats[TRACE_ID_COUNT] = {
+    [TRACE_NOTE_ON] = "NOTE ON: %u, Velocity: %u",
+    [TRACE_NOTE_OFF] = "NOTE OFF: %u",
+};
+
+// Longest formatted record, it is printed only when the CDC FIFO can take it at once
+#define TRACE_LINE_MAX 64
+
+static void trace_print(int core, const TraceRecord *r) {
+    char line[TRACE_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "[%u.%06u c%d] ", r->time_us / 1000000u, r->time_us % 1000000u, core);
+    if (r->id < TRACE_ID_COUNT) {
+        snprintf(line + len, sizeof(line) - len, trace_formats[r->id], r->arg0, r->arg1);
+    } else {
+        snprintf(line + len, sizeof(line) - len, "TRACE %u: %u %u", r->id, r->arg0, r->arg1);
+    }
+    printf("%s\n", line);
+}
+
+void trace_flush(void) {
+    for (int core = 0; core < 2; ++core) {
+        TraceRing *ring = &trace_rings[core];
+        uint32_t tail = ring->tail;
+        while (tail != ring->head) {
+            // Without a terminal the records are discarded, printing would only stall
+            if (tud_cdc_connected() && tud_cdc_write_available() < TRACE_LINE_MAX) return;
+            __dmb();
+            TraceRecord r = ring->record[tail & TRACE_RING_MASK];
+            __dmb();
+            ring->tail = ++tail;
+            if (tud_cdc_connected()) trace_print(core, &r);
+        }
+
+        static uint32_t reported_dropped[2];
+        if (ring->dropped != reported_dropped[core]) {
+            printf("WARNING: trace ring of core %d full, dropped records: %u\n", core, ring->dropped);
+            reported_dropped[core] = ring->dropped;
+        }
+    }
+}
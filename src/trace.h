@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/platform.h"
+
+// Deferred binary trace
+// The hot paths write fixed-size records into the ring of their core, core0 formats
+// and prints them later when USB stdio has room (trace_flush()).
+// Records below TRACE_LEVEL compile to nothing.
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+// Records per core, has to be a power of two
+#define TRACE_RING_SIZE 64
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+// Record types, formats are in trace.c
+typedef enum {
+    TRACE_NOTE_ON = 0,  // key, velocity
+    TRACE_NOTE_OFF,     // key
+    TRACE_ID_COUNT
+} TraceId;
+
+typedef struct {
+    uint32_t time_us;
+    uint16_t id;
+    uint16_t arg0;
+    uint32_t arg1;
+} TraceRecord;
+
+// Single-producer/single-consumer ring, the producer is the owning core (not its IRQs),
+// the consumer is trace_flush() on core0
+typedef struct {
+    TraceRecord record[TRACE_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;
+} TraceRing;
+
+extern TraceRing trace_rings[2];
+
+static inline void trace_record(uint16_t id, uint16_t arg0, uint32_t arg1) {
+    TraceRing *ring = &trace_rings[get_core_num()];
+    uint32_t head = ring->head;
+    if (head - ring->tail == TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    ring->record[head & TRACE_RING_MASK] = (TraceRecord){time_us_32(), id, arg0, arg1};
+    __dmb();
+    ring->head = head + 1;
+}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(id, arg0, arg1) trace_record((id), (arg0), (arg1))
+#else
+#define TRACE_ERROR(id, arg0, arg1) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(id, arg0, arg1) trace_record((id), (arg0), (arg1))
+#else
+#define TRACE_INFO(id, arg0, arg1) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(id, arg0, arg1) trace_record((id), (arg0), (arg1))
+#else
+#define TRACE_DEBUG(id, arg0, arg1) ((void)0)
+#endif
+
+// Prints the pending records of both cores while USB stdio has room, call it on core0
+void trace_flush(void);
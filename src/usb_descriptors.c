@@ -0,0 +1,106 @@
+#include "tusb.h"
+#include "pico/unique_id.h"
+
+// USB descriptors of the composite device: CDC for stdio and USB-MIDI for the notes.
+// The pico-sdk stdio driver uses these when the application links tinyusb_device.
+
+// TinyUSB example IDs - development only, replace with own VID/PID for a product
+#define USB_VID 0xCafe
+#define USB_PID (0x4000 | 0x01 | 0x08)  // CDC | MIDI
+#define USB_BCD 0x0200
+
+enum {
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_MIDI,
+    ITF_NUM_MIDI_STREAMING,
+    ITF_NUM_TOTAL
+};
+
+#define EPNUM_CDC_NOTIF 0x81
+#define EPNUM_CDC_OUT 0x02
+#define EPNUM_CDC_IN 0x82
+#define EPNUM_MIDI_OUT 0x03
+#define EPNUM_MIDI_IN 0x83
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC,
+    STRID_MIDI,
+};
+
+static const tusb_desc_device_t desc_device = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = USB_BCD,
+    // Interface association descriptor of CDC needs the miscellaneous device class
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USB_VID,
+    .idProduct = USB_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+    TUD_MIDI_DESCRIPTOR(ITF_NUM_MIDI, STRID_MIDI, EPNUM_MIDI_OUT, EPNUM_MIDI_IN, 64),
+};
+
+static const char *const string_desc[] = {
+    [STRID_MANUFACTURER] = "RPico",
+    [STRID_PRODUCT] = "Hall Scanner",
+    [STRID_SERIAL] = NULL,  // Unique board ID
+    [STRID_CDC] = "Hall Scanner Console",
+    [STRID_MIDI] = "Hall Scanner MIDI",
+};
+
+const uint8_t *tud_descriptor_device_cb(void) {
+    return (const uint8_t *)&desc_device;
+}
+
+const uint8_t *tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return desc_configuration;
+}
+
+const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    static uint16_t desc_str[33];
+    char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    const char *str;
+    (void)langid;
+
+    if (index == STRID_LANGID) {
+        desc_str[1] = 0x0409;  // English
+        desc_str[0] = (TUSB_DESC_STRING << 8) | 4;
+        return desc_str;
+    }
+    if (index >= sizeof(string_desc) / sizeof(string_desc[0])) return NULL;
+
+    if (index == STRID_SERIAL) {
+        pico_get_unique_board_id_string(serial, sizeof(serial));
+        str = serial;
+    } else {
+        str = string_desc[index];
+    }
+
+    // ASCII to UTF-16
+    uint8_t len = strlen(str);
+    if (len > 32) len = 32;
+    for (uint8_t i = 0; i < len; ++i) {
+        desc_str[1 + i] = str[i];
+    }
+    desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * len + 2);
+    return desc_str;
+}
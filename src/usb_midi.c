@@ -0,0 +1,79 @@
+#include "usb_midi.h"
+#include "tusb.h"
+#include "hardware/structs/usb.h"
+#include "pico/time.h"
+#include <string.h>
+
+// Messages of the current USB frame. Every message is written on its own by TinyUSB
+// as soon as the endpoint is free, so a chord would be spread over several frames.
+// Writing the whole frame in one tud_midi_stream_write() call queues all event
+// packets before the transfer starts.
+static uint8_t batch[USB_MIDI_BATCH_BYTES];
+static uint8_t batch_len = 0;
+static uint8_t batch_messages = 0;
+static uint32_t batch_frame;
+
+static UsbMidiStats stats;
+
+// Alarm waking core0 from __wfe() while a batch waits for the next USB frame
+static volatile alarm_id_t wake_alarm = 0;
+
+// Number of the current USB frame, counted by the SOF packets
+static inline uint32_t usb_frame_number(void) {
+    return usb_hw->sof_rd & USB_SOF_RD_BITS;
+}
+
+static void usb_midi_flush(void) {
+    // Host gone meanwhile - the messages are discarded
+    if (tud_midi_mounted()) {
+        uint32_t written = tud_midi_stream_write(USB_MIDI_CABLE, batch, batch_len);
+        if (written < batch_len) {
+            stats.dropped += batch_messages;
+        } else {
+            stats.messages += batch_messages;
+        }
+        stats.transfers++;
+    }
+    batch_len = 0;
+    batch_messages = 0;
+}
+
+void usb_midi_init(void) {
+    // pico-sdk stdio initializes TinyUSB with the descriptors of usb_descriptors.c
+    if (!tud_inited()) {
+        tusb_init();
+    }
+}
+
+bool usb_midi_send(const uint8_t *data, uint8_t length) {
+    if (!tud_midi_mounted()) return false;
+    if (batch_len + length > USB_MIDI_BATCH_BYTES) {
+        usb_midi_flush();
+    }
+    if (batch_len == 0) {
+        batch_frame = usb_frame_number();
+    }
+    memcpy(&batch[batch_len], data, length);
+    batch_len += length;
+    batch_messages++;
+    return true;
+}
+
+// The interrupt itself wakes the core, nothing to do here
+static int64_t wake_alarm_callback(alarm_id_t id, void *user_data) {
+    wake_alarm = 0;
+    return 0;
+}
+
+void usb_midi_task(void) {
+    if (batch_len && usb_frame_number() != batch_frame) {
+        usb_midi_flush();
+    }
+    if (batch_len && !wake_alarm) {
+        wake_alarm = add_alarm_in_us(USB_MIDI_WAKE_US, wake_alarm_callback, NULL, true);
+    }
+}
+
+void usb_midi_get_stats(UsbMidiStats *out) {
+    *out = stats;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// USB-MIDI output, cable 0 of the composite CDC + MIDI device (see usb_descriptors.c)
+#define USB_MIDI_CABLE 0
+
+// Raw MIDI bytes collected in one USB frame. TinyUSB packs them into 4-byte event
+// packets, 16 of them fill one full-speed bulk transfer.
+#define USB_MIDI_BATCH_BYTES (16 * 3)
+
+// Wake-up interval of core0 while a batch waits for the next USB frame (1 ms).
+// The start of frame raises no interrupt, so the batch is written within this time after it.
+#define USB_MIDI_WAKE_US 250
+
+typedef struct {
+    uint32_t messages;   // Messages handed over to TinyUSB
+    uint32_t transfers;  // Batches written, one bulk transfer each
+    uint32_t dropped;    // Messages lost because the TinyUSB FIFO was full
+} UsbMidiStats;
+
+void usb_midi_init(void);
+
+// Adds a message to the batch of the current USB frame
+bool usb_midi_send(const uint8_t *data, uint8_t length);
+
+// Writes the batch once a new USB frame has started, call it after usb_midi_send()
+// and whenever the core wakes up. Arms an alarm waking the core while a batch waits.
+void usb_midi_task(void);
+
+void usb_midi_get_stats(UsbMidiStats *stats);
@@ -0,0 +1,68 @@
+#include "velocity_curve.h"
+#include <math.h>
+
+const char *const velocity_curve_names[VELOCITY_CURVE_COUNT] = {
+    [VELOCITY_CURVE_LINEAR] = "Linear",
+    [VELOCITY_CURVE_SOFT] = "Soft",
+    [VELOCITY_CURVE_HARD] = "Hard",
+    [VELOCITY_CURVE_LOG] = "Logarithmic",
+    [VELOCITY_CURVE_USER] = "User",
+};
+
+#define USER_SEGMENTS (VELOCITY_CURVE_USER_POINTS - 1)
+
+static uint8_t clamp_velocity(int velocity) {
+    if (velocity < 1) return 1;
+    if (velocity > 127) return 127;
+    return (uint8_t)velocity;
+}
+
+// Linear interpolation between the points, segment n spans inputs n x 127/8 to (n + 1) x 127/8
+static uint8_t user_curve_value(const uint8_t *points, int input) {
+    int pos = input * USER_SEGMENTS;
+    int segment = pos / 127;
+    if (segment >= USER_SEGMENTS) return points[USER_SEGMENTS];
+    int frac = pos - segment * 127;
+    int from = points[segment];
+    int to = points[segment + 1];
+    return clamp_velocity(from + ((to - from) * frac + (to >= from ? 63 : -63)) / 127);
+}
+
+void velocity_curve_build(uint8_t curve, const uint8_t *user_points, uint8_t *lut) {
+    for (int i = 0; i < VELOCITY_CURVE_SIZE; ++i) {
+        float x = (float)i / 127.0f;
+        float y;
+        switch (curve) {
+            case VELOCITY_CURVE_SOFT:
+                y = powf(x, VELOCITY_CURVE_SOFT_GAMMA);
+                break;
+            case VELOCITY_CURVE_HARD:
+                y = powf(x, VELOCITY_CURVE_HARD_GAMMA);
+                break;
+            case VELOCITY_CURVE_LOG:
+                y = logf(1.0f + VELOCITY_CURVE_LOG_STEEPNESS * x) / logf(1.0f + VELOCITY_CURVE_LOG_STEEPNESS);
+                break;
+            case VELOCITY_CURVE_USER:
+                lut[i] = user_curve_value(user_points, i);
+                continue;
+            default:
+                y = x;
+                break;
+        }
+        lut[i] = clamp_velocity((int)(y * 127.0f + 0.5f));
+    }
+}
+
+void velocity_curve_user_default(uint8_t *user_points) {
+    for (int i = 0; i < VELOCITY_CURVE_USER_POINTS; ++i) {
+        user_points[i] = clamp_velocity((i * 127 + USER_SEGMENTS / 2) / USER_SEGMENTS);
+    }
+}
+
+// Every point is a MIDI velocity, curves may fall
+bool velocity_curve_user_valid(const uint8_t *user_points) {
+    for (int i = 0; i < VELOCITY_CURVE_USER_POINTS; ++i) {
+        if (user_points[i] < 1 || user_points[i] > 127) return false;
+    }
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Velocity curves
+// The velocity engine computes a linear velocity 1-127, the curve LUT maps it to the
+// MIDI velocity sent. Curves are built once at start, the hot path is a table lookup.
+#define VELOCITY_CURVE_SIZE 128
+
+#define VELOCITY_CURVE_LINEAR 0
+#define VELOCITY_CURVE_SOFT 1   // Louder light touches
+#define VELOCITY_CURVE_HARD 2   // Needs more force for the same velocity
+#define VELOCITY_CURVE_LOG 3    // Logarithmic, strongest boost of light touches
+#define VELOCITY_CURVE_USER 4   // Interpolated from the user points
+#define VELOCITY_CURVE_COUNT 5
+
+// Exponents of the soft and hard power curves, steepness of the logarithmic curve
+#define VELOCITY_CURVE_SOFT_GAMMA 0.6f
+#define VELOCITY_CURVE_HARD_GAMMA 1.7f
+#define VELOCITY_CURVE_LOG_STEEPNESS 9.0f
+
+// User curve: output velocity 1-127 at the linear velocities 0, 1/8, 2/8 ... 8/8 of 127
+#define VELOCITY_CURVE_USER_POINTS 9
+
+extern const char *const velocity_curve_names[VELOCITY_CURVE_COUNT];
+
+// Fills lut with VELOCITY_CURVE_SIZE velocities 1-127, user_points is used by VELOCITY_CURVE_USER only
+void velocity_curve_build(uint8_t curve, const uint8_t *user_points, uint8_t *lut);
+
+// Straight line, the user curve equal to VELOCITY_CURVE_LINEAR
+void velocity_curve_user_default(uint8_t *user_points);
+bool velocity_curve_user_valid(const uint8_t *user_points);
@@ -0,0 +1,96 @@
+// Host check of the MIDI wire encoding (src/midi_encode.c), no pico-sdk needed:
+//   gcc -std=gnu11 -Wall -Isrc test/midi_encode_check.c src/midi_encode.c -o midi_encode_check && ./midi_encode_check
+#include <stdio.h>
+#include <string.h>
+#include "midi_encode.h"
+
+static int failures = 0;
+
+static void expect(const char *name, const uint8_t *got, uint8_t got_count, const uint8_t *want, uint8_t want_count) {
+    if (got_count == want_count && memcmp(got, want, want_count) == 0) return;
+    printf("ERROR: %s: got", name);
+    for (int i = 0; i < got_count; ++i) printf(" %02X", got[i]);
+    printf(", expected");
+    for (int i = 0; i < want_count; ++i) printf(" %02X", want[i]);
+    printf("\n");
+    failures++;
+}
+
+#define EXPECT(name, got, got_count, ...)                                         \
+    do {                                                                          \
+        static const uint8_t want[] = {__VA_ARGS__};                              \
+        expect(name, got, got_count, want, sizeof(want));                         \
+    } while (0)
+
+static void check_serialize(void) {
+    uint8_t data[MIDI_MESSAGE_MAX_BYTES];
+    MidiEvent on = {.type = MIDI_EVENT_NOTE_ON, .key = 12, .velocity = 100};
+    MidiEvent off = {.type = MIDI_EVENT_NOTE_OFF, .key = 12, .velocity = 64};
+
+    EXPECT("serialize note on", data, midi_event_serialize(&on, 3, 48, data), 0x93, 60, 100);
+    EXPECT("serialize note off", data, midi_event_serialize(&off, 3, 48, data), 0x83, 60, 64);
+    // The channel is masked to 4 bits, the top note is 127
+    EXPECT("serialize top note", data, midi_event_serialize(&on, 0x13, 115, data), 0x93, 127, 100);
+    // Notes above 127 are dropped, not wrapped
+    if (midi_event_serialize(&on, 3, 116, data) != 0 || midi_event_serialize(&off, 3, 200, data) != 0) {
+        printf("ERROR: serialize out of range: note above 127 not dropped\n");
+        failures++;
+    }
+}
+
+static void check_running_status(void) {
+    MidiRunningStatus rs = {0};
+    uint8_t out[MIDI_MESSAGE_MAX_BYTES];
+    uint32_t t = 1000;
+
+    static const uint8_t on_60[] = {0x90, 60, 100};
+    static const uint8_t on_62[] = {0x90, 62, 90};
+    static const uint8_t off_60[] = {0x80, 60, 64};
+    static const uint8_t zero_62[] = {0x90, 62, 0};
+    static const uint8_t on_ch2[] = {0x91, 60, 100};
+    static const uint8_t song_select[] = {0xF3, 1};
+    static const uint8_t clock[] = {0xF8};
+
+    EXPECT("first message", out, midi_running_status_encode(&rs, on_60, 3, t, out), 0x90, 60, 100);
+#if MIDI_RUNNING_STATUS_ENABLED
+    EXPECT("repeated status", out, midi_running_status_encode(&rs, on_62, 3, t + 10, out), 62, 90);
+#if MIDI_NOTE_OFF_AS_ZERO_VELOCITY
+    EXPECT("note off as velocity 0", out, midi_running_status_encode(&rs, off_60, 3, t + 20, out), 60, 0);
+#endif
+    EXPECT("velocity 0 note off", out, midi_running_status_encode(&rs, zero_62, 3, t + 30, out), 62, 0);
+    // Real-time messages interleave without touching the running status
+    EXPECT("real-time", out, midi_running_status_encode(&rs, clock, 1, t + 40, out), 0xF8);
+    EXPECT("after real-time", out, midi_running_status_encode(&rs, on_60, 3, t + 50, out), 60, 100);
+    // The status byte is repeated after the refresh interval, counted from the last full status
+    EXPECT("refresh", out, midi_running_status_encode(&rs, on_62, 3, t + MIDI_RUNNING_STATUS_REFRESH_US, out),
+           0x90, 62, 90);
+    t += MIDI_RUNNING_STATUS_REFRESH_US;
+    EXPECT("after refresh", out, midi_running_status_encode(&rs, on_60, 3, t + 10, out), 60, 100);
+    // Another channel needs its status byte
+    EXPECT("other channel", out, midi_running_status_encode(&rs, on_ch2, 3, t + 20, out), 0x91, 60, 100);
+    // System common messages cancel the running status
+    EXPECT("system common", out, midi_running_status_encode(&rs, song_select, 2, t + 30, out), 0xF3, 1);
+    EXPECT("after system common", out, midi_running_status_encode(&rs, on_ch2, 3, t + 40, out), 0x91, 60, 100);
+#endif
+#if MIDI_NOTE_OFF_AS_ZERO_VELOCITY
+    rs = (MidiRunningStatus){0};
+    EXPECT("note off first", out, midi_running_status_encode(&rs, off_60, 3, t, out), 0x90, 60, 0);
+#endif
+    // Time wraps around every 2^32 us
+    rs = (MidiRunningStatus){0};
+    midi_running_status_encode(&rs, on_60, 3, 0xFFFFFF00u, out);
+#if MIDI_RUNNING_STATUS_ENABLED
+    EXPECT("time wrap", out, midi_running_status_encode(&rs, on_62, 3, 0x00000100u, out), 62, 90);
+#endif
+}
+
+int main(void) {
+    check_serialize();
+    check_running_status();
+    if (failures) {
+        printf("ERROR: %d MIDI encoding checks failed\n", failures);
+        return 1;
+    }
+    printf("MIDI encoding checks passed\n");
+    return 0;
+}
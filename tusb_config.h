@@ -0,0 +1,28 @@
+#ifndef TUSB_CONFIG_H
+#define TUSB_CONFIG_H
+
+// TinyUSB configuration - composite device with CDC (stdio) and USB-MIDI
+// Descriptors are in src/usb_descriptors.c
+
+#define CFG_TUSB_RHPORT0_MODE       OPT_MODE_DEVICE
+#define CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_ALIGN          __attribute__((aligned(4)))
+
+#define CFG_TUD_ENDPOINT0_SIZE      64
+
+// Device classes
+#define CFG_TUD_CDC                 1
+#define CFG_TUD_MSC                 0
+#define CFG_TUD_HID                 0
+#define CFG_TUD_MIDI                1
+#define CFG_TUD_VENDOR              0
+
+// CDC FIFO sizes, same as the pico-sdk stdio defaults
+#define CFG_TUD_CDC_RX_BUFSIZE      256
+#define CFG_TUD_CDC_TX_BUFSIZE      256
+
+// MIDI FIFO sizes - one full-speed bulk packet holds 16 event packets
+#define CFG_TUD_MIDI_RX_BUFSIZE     64
+#define CFG_TUD_MIDI_TX_BUFSIZE     256
+
+#endif